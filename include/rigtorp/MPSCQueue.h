@@ -0,0 +1,354 @@
+#pragma once
+
+#include "SPSCQueue.h" // detail::park, detail::notify
+
+namespace rigtorp {
+
+// Bounded lock-free queue for any number of producers and a single consumer,
+// with the same interface as SPSCQueue.
+//
+// Producers claim positions with a CAS on head_, so the elements one thread
+// pushes are consumed in the order it pushed them, interleaved with those of
+// other threads in claim order. Every slot has a sequence number (Dmitry
+// Vyukov's bounded queue): seq == pos means the slot is free for the
+// producer claiming pos, seq == pos + 1 means the element at pos is ready.
+// The sequence numbers live apart from the elements so the consumer can
+// hand out contiguous spans of them.
+//
+// A producer that throws after claiming a slot would stall the consumer
+// forever, so elements must be nothrow constructible from the arguments.
+// push(const T &) copies before claiming to get around that.
+template <typename T, typename Allocator = std::allocator<T>> class MPSCQueue {
+public:
+  struct span {
+    T *data;
+    size_t size;
+  };
+
+  // Elements in FIFO order: all of first, then all of second. second is only
+  // non-empty when the elements wrap around the end of the ring.
+  struct spans {
+    span first;
+    span second;
+
+    size_t size() const noexcept { return first.size + second.size; }
+  };
+
+  // capacity is rounded up to a power of two.
+  explicit MPSCQueue(const size_t capacity,
+                     const Allocator &allocator = Allocator())
+      : capacity_(1), allocator_(allocator) {
+    while (capacity_ < capacity) {
+      capacity_ *= 2;
+    }
+    mask_ = capacity_ - 1;
+    slots_ = std::allocator_traits<Allocator>::allocate(
+        allocator_, capacity_ + 2 * kPadding);
+    sequences_.reset(new std::atomic<size_t>[capacity_]);
+    for (size_t i = 0; i < capacity_; ++i) {
+      sequences_[i].store(i, std::memory_order_relaxed);
+    }
+
+    static_assert(alignof(MPSCQueue<T>) == kCacheLineSize, "");
+    static_assert(sizeof(MPSCQueue<T>) >= 3 * kCacheLineSize, "");
+  }
+
+  ~MPSCQueue() {
+    while (front()) {
+      pop();
+    }
+    std::allocator_traits<Allocator>::deallocate(allocator_, slots_,
+                                                 capacity_ + 2 * kPadding);
+  }
+
+  // non-copyable and non-movable
+  MPSCQueue(const MPSCQueue &) = delete;
+  MPSCQueue &operator=(const MPSCQueue &) = delete;
+
+  template <typename... Args> void emplace(Args &&...args) noexcept {
+    while (!try_emplace(std::forward<Args>(args)...)) {
+      auto const stallStart = telemetry_.now();
+      detail::park(producerWaiting_, producerSeq_, [&] { return !full(); },
+                   std::chrono::steady_clock::time_point::max());
+      telemetry_.fullStall(stallStart);
+    }
+  }
+
+  template <typename... Args> bool try_emplace(Args &&...args) noexcept {
+    static_assert(std::is_nothrow_constructible<T, Args &&...>::value,
+                  "T must be nothrow constructible from the arguments");
+    auto pos = head_.load(std::memory_order_relaxed);
+    for (;;) {
+      auto const seq = sequences_[pos & mask_].load(std::memory_order_acquire);
+      auto const diff =
+          static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+    new (&slots_[(pos & mask_) + kPadding]) T(std::forward<Args>(args)...);
+    sequences_[pos & mask_].store(pos + 1, std::memory_order_release);
+    published(pos + 1);
+    return true;
+  }
+
+  // Like try_emplace, but parks the thread for up to timeout while the queue
+  // is full.
+  template <typename Rep, typename Period, typename... Args>
+  bool wait_emplace(const std::chrono::duration<Rep, Period> &timeout,
+                    Args &&...args) noexcept {
+    auto const deadline = detail::deadlineAfter(timeout);
+    while (!try_emplace(std::forward<Args>(args)...)) {
+      auto const stallStart = telemetry_.now();
+      bool const ready = detail::park(producerWaiting_, producerSeq_,
+                                      [&] { return !full(); }, deadline);
+      telemetry_.fullStall(stallStart);
+      if (!ready) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void push(const T &v) noexcept(std::is_nothrow_copy_constructible<T>::value) {
+    T copy(v);
+    emplace(std::move(copy));
+  }
+
+  template <typename P, typename = typename std::enable_if<
+                            std::is_constructible<T, P &&>::value>::type>
+  void push(P &&v) noexcept {
+    emplace(std::forward<P>(v));
+  }
+
+  template <typename P, typename = typename std::enable_if<
+                            std::is_constructible<T, P &&>::value>::type>
+  bool try_push(P &&v) noexcept {
+    return try_emplace(std::forward<P>(v));
+  }
+
+  template <typename Rep, typename Period, typename P,
+            typename = typename std::enable_if<
+                std::is_constructible<T, P &&>::value>::type>
+  bool wait_push(P &&v,
+                 const std::chrono::duration<Rep, Period> &timeout) noexcept {
+    return wait_emplace(timeout, std::forward<P>(v));
+  }
+
+  // Claims as many of count consecutive positions as are free with a single
+  // CAS, constructs the elements from *first, *++first and so on, and
+  // returns how many were pushed. They stay together in the queue, in order.
+  template <typename InputIt>
+  size_t push_n(InputIt first, size_t count) noexcept {
+    static_assert(std::is_nothrow_constructible<T, decltype(*first)>::value,
+                  "T must be nothrow constructible from *first");
+    if (count == 0) {
+      return 0;
+    }
+    auto pos = head_.load(std::memory_order_relaxed);
+    size_t n;
+    for (;;) {
+      auto const tail = tail_.load(std::memory_order_acquire);
+      auto const used = pos - tail;
+      if (used > capacity_) {
+        // pos is stale: others pushed and the consumer popped past it since
+        // it was loaded. head_ is at least tail now, so reload and retry.
+        pos = head_.load(std::memory_order_relaxed);
+        continue;
+      }
+      n = count < capacity_ - used ? count : capacity_ - used;
+      if (n == 0) {
+        // Only full if no one claimed anything since pos was loaded.
+        auto const current = head_.load(std::memory_order_relaxed);
+        if (current == pos) {
+          return 0;
+        }
+        pos = current;
+        continue;
+      }
+      if (head_.compare_exchange_weak(pos, pos + n,
+                                      std::memory_order_relaxed)) {
+        break;
+      }
+    }
+    for (size_t i = 0; i < n; ++i, ++first) {
+      new (&slots_[((pos + i) & mask_) + kPadding]) T(*first);
+      sequences_[(pos + i) & mask_].store(pos + i + 1,
+                                          std::memory_order_release);
+    }
+    published(pos + n);
+    return n;
+  }
+
+  T *front() noexcept {
+    auto const tail = tail_.load(std::memory_order_relaxed);
+    if (!ready(tail)) {
+      return nullptr;
+    }
+    return &slots_[(tail & mask_) + kPadding];
+  }
+
+  void pop() noexcept { pop_n(1); }
+
+  // Returns up to n of the elements ready to be consumed. Release them with
+  // pop_n once done.
+  spans front_n(size_t n) noexcept {
+    auto const tail = tail_.load(std::memory_order_relaxed);
+    size_t count = 0;
+    while (count < n && count < capacity_ && ready(tail + count)) {
+      ++count;
+    }
+    auto const index = tail & mask_;
+    auto const untilEnd = capacity_ - index;
+    spans result{{&slots_[index + kPadding], count},
+                 {&slots_[kPadding], 0}};
+    if (count > untilEnd) {
+      result.first.size = untilEnd;
+      result.second.size = count - untilEnd;
+    }
+    return result;
+  }
+
+  // Destroys the n oldest elements and hands their slots back to the
+  // producers with a single update of tail_.
+  void pop_n(size_t n) noexcept {
+    static_assert(std::is_nothrow_destructible<T>::value,
+                  "T must be nothrow destructible");
+    if (n == 0) {
+      return;
+    }
+    auto const tail = tail_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < n; ++i) {
+      auto const pos = tail + i;
+      assert(ready(pos));
+      slots_[(pos & mask_) + kPadding].~T();
+      sequences_[pos & mask_].store(pos + capacity_, std::memory_order_release);
+    }
+    tail_.store(tail + n, std::memory_order_release);
+    detail::notify(producerWaiting_, producerSeq_, true);
+  }
+
+  // Like front, but parks the thread for up to timeout while the queue is
+  // empty.
+  template <typename Rep, typename Period>
+  T *wait_front(const std::chrono::duration<Rep, Period> &timeout) noexcept {
+    if (T *element = front()) {
+      return element;
+    }
+    auto const stallStart = telemetry_.now();
+    detail::park(consumerWaiting_, consumerSeq_,
+                 [&] { return front() != nullptr; },
+                 detail::deadlineAfter(timeout));
+    telemetry_.emptyStall(stallStart);
+    return front();
+  }
+
+  // Like wait_front, but also returns once interrupted() is true. Whoever
+  // makes it true calls wake_consumer afterwards.
+  template <typename Rep, typename Period, typename Interrupted>
+  T *wait_front(const std::chrono::duration<Rep, Period> &timeout,
+                Interrupted interrupted) noexcept {
+    if (T *element = front()) {
+      return element;
+    }
+    auto const stallStart = telemetry_.now();
+    detail::park(consumerWaiting_, consumerSeq_,
+                 [&] { return front() != nullptr || interrupted(); },
+                 detail::deadlineAfter(timeout));
+    telemetry_.emptyStall(stallStart);
+    return front();
+  }
+
+  // Safe to call from any thread.
+  void wake_consumer() noexcept {
+    detail::notify(consumerWaiting_, consumerSeq_);
+  }
+
+  // Counts claimed positions, some of which may still be under construction.
+  size_t size() const noexcept {
+    auto const tail = tail_.load(std::memory_order_acquire);
+    return head_.load(std::memory_order_acquire) - tail;
+  }
+
+  bool empty() const noexcept { return size() == 0; }
+
+  size_t capacity() const noexcept { return capacity_; }
+
+  // Safe to call from any thread.
+  QueueStats stats() const noexcept {
+    QueueStats stats;
+    stats.depth = size();
+    telemetry_.read(stats);
+    return stats;
+  }
+
+private:
+#ifdef __cpp_lib_hardware_interference_size
+  static constexpr size_t kCacheLineSize =
+      std::hardware_destructive_interference_size;
+#else
+  static constexpr size_t kCacheLineSize = 64;
+#endif
+
+  // Padding to avoid false sharing between slots_ and adjacent allocations
+  static constexpr size_t kPadding = (kCacheLineSize - 1) / sizeof(T) + 1;
+
+  bool ready(size_t pos) const noexcept {
+    return sequences_[pos & mask_].load(std::memory_order_acquire) == pos + 1;
+  }
+
+  // Producer side, after publishing elements up to end.
+  void published(size_t end) noexcept {
+    detail::notify(consumerWaiting_, consumerSeq_);
+    if (detail::Telemetry::enabled) {
+      // Other producers' elements may already be consumed past end.
+      auto const tail = tail_.load(std::memory_order_relaxed);
+      telemetry_.depth(end > tail ? end - tail : 0);
+    }
+  }
+
+  bool full() const noexcept {
+    return head_.load(std::memory_order_relaxed) -
+               tail_.load(std::memory_order_acquire) >=
+           capacity_;
+  }
+
+private:
+  size_t capacity_;
+  size_t mask_;
+  T *slots_;
+  std::unique_ptr<std::atomic<size_t>[]> sequences_;
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+  Allocator allocator_ [[no_unique_address]];
+#else
+  Allocator allocator_;
+#endif
+
+  // Only written when a thread parks or wakes another one. Any number of
+  // producers can be parked at once.
+  std::atomic<uint32_t> consumerWaiting_ = {0};
+  std::atomic<uint32_t> consumerSeq_ = {0};
+  std::atomic<uint32_t> producerWaiting_ = {0};
+  std::atomic<uint32_t> producerSeq_ = {0};
+
+  // Positions grow without wrapping; slots are indexed with pos & mask_.
+  alignas(kCacheLineSize) std::atomic<size_t> head_ = {0};
+  alignas(kCacheLineSize) std::atomic<size_t> tail_ = {0};
+
+  // Padding to avoid adjacent allocations to share cache line with tail_
+  char padding_[kCacheLineSize - sizeof(tail_)];
+
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+  detail::Telemetry telemetry_ [[no_unique_address]];
+#else
+  detail::Telemetry telemetry_;
+#endif
+};
+} // namespace rigtorp
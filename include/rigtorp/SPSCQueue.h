@@ -24,14 +24,275 @@ SOFTWARE.
 
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <memory> // std::allocator
 #include <new>    // std::hardware_destructive_interference_size
 #include <stdexcept>
+#include <thread>
 #include <type_traits> // std::enable_if, std::is_*_constructible
 
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#elif defined(__linux__)
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 namespace rigtorp {
 
+namespace detail {
+
+// Parks the calling thread while word == expected, for at most timeout.
+// Can return early, so callers re-check their condition.
+inline void futexWait(std::atomic<uint32_t> &word, uint32_t expected,
+                      std::chrono::nanoseconds timeout) noexcept {
+#if defined(_WIN32)
+  auto ms = std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+  if (ms >= static_cast<decltype(ms)>(INFINITE)) {
+    ms = INFINITE - 1;
+  }
+  WaitOnAddress(&word, &expected, sizeof(expected), static_cast<DWORD>(ms));
+#elif defined(__linux__)
+  timespec ts;
+  ts.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+  ts.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+  syscall(SYS_futex, &word, FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0);
+#else
+  auto const deadline = std::chrono::steady_clock::now() + timeout;
+  while (word.load(std::memory_order_acquire) == expected &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+#endif
+}
+
+inline void futexWakeOne(std::atomic<uint32_t> &word) noexcept {
+#if defined(_WIN32)
+  WakeByAddressSingle(&word);
+#elif defined(__linux__)
+  syscall(SYS_futex, &word, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+  (void)word;
+#endif
+}
+
+inline void futexWakeAll(std::atomic<uint32_t> &word) noexcept {
+#if defined(_WIN32)
+  WakeByAddressAll(&word);
+#elif defined(__linux__)
+  syscall(SYS_futex, &word, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+  (void)word;
+#endif
+}
+
+// Heavy side of an asymmetric fence. Orders the caller's earlier stores
+// before its later loads and forces every other running thread of the
+// process through a full barrier, so the light side can get away with a
+// compiler barrier. Returns false when the platform has no such barrier and
+// only the caller was fenced; a waiter must then poll instead of relying on
+// being woken.
+inline bool heavyFence() noexcept {
+#if defined(_WIN32)
+  FlushProcessWriteBuffers();
+  return true;
+#elif defined(__linux__)
+  static const bool registered =
+      syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0,
+              0) == 0;
+  if (registered &&
+      syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0) == 0) {
+    return true;
+  }
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  return false;
+#else
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  return false;
+#endif
+}
+
+inline void lightFence() noexcept {
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+// Spins before parking, to ride out short stalls without a system call.
+constexpr int kSpinCount = 128;
+
+template <typename Rep, typename Period>
+std::chrono::steady_clock::time_point
+deadlineAfter(const std::chrono::duration<Rep, Period> &timeout) noexcept {
+  auto const now = std::chrono::steady_clock::now();
+  auto const remaining = std::chrono::steady_clock::time_point::max() - now;
+  if (std::chrono::duration<double>(timeout) >=
+      std::chrono::duration<double>(remaining)) {
+    return std::chrono::steady_clock::time_point::max();
+  }
+  return now +
+         std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+             timeout);
+}
+
+// Waits until ready() or the deadline. waiting counts the parked threads.
+// A waiter registers itself, then issues the heavy fence before re-checking
+// ready(), while the other side only needs a compiler barrier between
+// publishing an index and reading waiting. Either the other side sees the
+// waiter and wakes it, or its index store is visible to the re-check.
+template <typename Ready>
+bool park(std::atomic<uint32_t> &waiting, std::atomic<uint32_t> &seq,
+          Ready ready, std::chrono::steady_clock::time_point deadline) noexcept {
+  for (int i = 0; i < kSpinCount; ++i) {
+    if (ready()) {
+      return true;
+    }
+  }
+  for (;;) {
+    auto const observed = seq.load(std::memory_order_acquire);
+    waiting.fetch_add(1, std::memory_order_relaxed);
+    bool const exact = heavyFence();
+    if (ready()) {
+      waiting.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+    auto const now = std::chrono::steady_clock::now();
+    if (now >= deadline) {
+      waiting.fetch_sub(1, std::memory_order_relaxed);
+      return false;
+    }
+    std::chrono::nanoseconds slice = deadline - now;
+    if (!exact && slice > std::chrono::milliseconds(1)) {
+      slice = std::chrono::milliseconds(1);
+    }
+    futexWait(seq, observed, slice);
+    waiting.fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+
+// Only makes a system call when a thread is parked, which it only does
+// after finding the queue empty (consumer) or full (producer).
+inline void notify(std::atomic<uint32_t> &waiting, std::atomic<uint32_t> &seq,
+                   bool all = false) noexcept {
+  lightFence();
+  if (waiting.load(std::memory_order_relaxed) != 0) {
+    seq.fetch_add(1, std::memory_order_release);
+    if (all) {
+      futexWakeAll(seq);
+    } else {
+      futexWakeOne(seq);
+    }
+  }
+}
+
+} // namespace detail
+
+// Snapshot of a queue. Only depth is filled in unless the program is built
+// with RIGTORP_QUEUE_TELEMETRY defined. A stall is a push that found the
+// queue full or a wait that found it empty, and lasts until the thread can
+// go on.
+struct QueueStats {
+  size_t depth = 0;
+  size_t high_water = 0;
+  uint64_t full_stalls = 0;
+  uint64_t full_stall_nanoseconds = 0;
+  uint64_t empty_stalls = 0;
+  uint64_t empty_stall_nanoseconds = 0;
+};
+
+namespace detail {
+
+#ifdef RIGTORP_QUEUE_TELEMETRY
+// Counters sit on their own cache lines, away from the queue indices, and
+// are only written on stalls or when the depth passes the high-water mark.
+class Telemetry {
+public:
+  using TimePoint = std::chrono::steady_clock::time_point;
+
+  static constexpr bool enabled = true;
+
+  TimePoint now() const noexcept { return std::chrono::steady_clock::now(); }
+
+  // Cheap pre-check, so the exact depth is only computed when it might be a
+  // new high-water mark.
+  bool above(size_t depth) const noexcept {
+    return depth > highWater_.load(std::memory_order_relaxed);
+  }
+
+  void depth(size_t depth) noexcept {
+    auto highWater = highWater_.load(std::memory_order_relaxed);
+    while (depth > highWater &&
+           !highWater_.compare_exchange_weak(highWater, depth,
+                                             std::memory_order_relaxed)) {
+    }
+  }
+
+  void fullStall(TimePoint start) noexcept {
+    fullStalls_.fetch_add(1, std::memory_order_relaxed);
+    fullStallNanoseconds_.fetch_add(since(start), std::memory_order_relaxed);
+  }
+
+  void emptyStall(TimePoint start) noexcept {
+    emptyStalls_.fetch_add(1, std::memory_order_relaxed);
+    emptyStallNanoseconds_.fetch_add(since(start), std::memory_order_relaxed);
+  }
+
+  void read(QueueStats &stats) const noexcept {
+    stats.high_water = highWater_.load(std::memory_order_relaxed);
+    stats.full_stalls = fullStalls_.load(std::memory_order_relaxed);
+    stats.full_stall_nanoseconds =
+        fullStallNanoseconds_.load(std::memory_order_relaxed);
+    stats.empty_stalls = emptyStalls_.load(std::memory_order_relaxed);
+    stats.empty_stall_nanoseconds =
+        emptyStallNanoseconds_.load(std::memory_order_relaxed);
+  }
+
+private:
+  static uint64_t since(TimePoint start) noexcept {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count());
+  }
+
+  // Producer side.
+  alignas(64) std::atomic<size_t> highWater_ = {0};
+  std::atomic<uint64_t> fullStalls_ = {0};
+  std::atomic<uint64_t> fullStallNanoseconds_ = {0};
+
+  // Consumer side.
+  alignas(64) std::atomic<uint64_t> emptyStalls_ = {0};
+  std::atomic<uint64_t> emptyStallNanoseconds_ = {0};
+};
+#else
+class Telemetry {
+public:
+  struct TimePoint {};
+
+  static constexpr bool enabled = false;
+
+  TimePoint now() const noexcept { return {}; }
+  bool above(size_t) const noexcept { return false; }
+  void depth(size_t) noexcept {}
+  void fullStall(TimePoint) noexcept {}
+  void emptyStall(TimePoint) noexcept {}
+  void read(QueueStats &) const noexcept {}
+};
+#endif
+
+} // namespace detail
+
 template <typename T, typename Allocator = std::allocator<T>> class SPSCQueue {
 
 #if defined(__cpp_if_constexpr) && defined(__cpp_lib_void_t)
@@ -102,11 +363,19 @@ public:
     if (nextWriteIdx == capacity_) {
       nextWriteIdx = 0;
     }
-    while (nextWriteIdx == readIdxCache_) {
+    if (nextWriteIdx == readIdxCache_) {
       readIdxCache_ = readIdx_.load(std::memory_order_acquire);
+      if (nextWriteIdx == readIdxCache_) {
+        auto const stallStart = telemetry_.now();
+        detail::park(producerWaiting_, producerSeq_,
+                     [&] { return hasSpaceFor(nextWriteIdx); },
+                     std::chrono::steady_clock::time_point::max());
+        telemetry_.fullStall(stallStart);
+      }
     }
     new (&slots_[writeIdx + kPadding]) T(std::forward<Args>(args)...);
     writeIdx_.store(nextWriteIdx, std::memory_order_release);
+    published(nextWriteIdx);
   }
 
   template <typename... Args>
@@ -127,9 +396,32 @@ public:
     }
     new (&slots_[writeIdx + kPadding]) T(std::forward<Args>(args)...);
     writeIdx_.store(nextWriteIdx, std::memory_order_release);
+    published(nextWriteIdx);
     return true;
   }
 
+  // Like try_emplace, but parks the thread for up to timeout while the queue
+  // is full.
+  template <typename Rep, typename Period, typename... Args>
+  bool wait_emplace(const std::chrono::duration<Rep, Period> &timeout,
+                    Args &&...args) noexcept(
+      std::is_nothrow_constructible<T, Args &&...>::value) {
+    if (try_emplace(std::forward<Args>(args)...)) {
+      return true;
+    }
+    auto const deadline = detail::deadlineAfter(timeout);
+    auto nextWriteIdx = writeIdx_.load(std::memory_order_relaxed) + 1;
+    if (nextWriteIdx == capacity_) {
+      nextWriteIdx = 0;
+    }
+    auto const stallStart = telemetry_.now();
+    bool const ready =
+        detail::park(producerWaiting_, producerSeq_,
+                     [&] { return hasSpaceFor(nextWriteIdx); }, deadline);
+    telemetry_.fullStall(stallStart);
+    return ready && try_emplace(std::forward<Args>(args)...);
+  }
+
   void push(const T &v) noexcept(std::is_nothrow_copy_constructible<T>::value) {
     static_assert(std::is_copy_constructible<T>::value,
                   "T must be copy constructible");
@@ -155,6 +447,92 @@ public:
     return try_emplace(std::forward<P>(v));
   }
 
+  template <typename Rep, typename Period, typename P,
+            typename = typename std::enable_if<
+                std::is_constructible<T, P &&>::value>::type>
+  bool wait_push(P &&v, const std::chrono::duration<Rep, Period> &timeout) noexcept(
+      std::is_nothrow_constructible<T, P &&>::value) {
+    return wait_emplace(timeout, std::forward<P>(v));
+  }
+
+  // A run of contiguous slots.
+  struct span {
+    T *data;
+    size_t size;
+  };
+
+  // Elements in FIFO order: all of first, then all of second. second is only
+  // non-empty when the elements wrap around the end of the ring.
+  struct spans {
+    span first;
+    span second;
+
+    size_t size() const noexcept { return first.size + second.size; }
+  };
+
+  // Returns up to n uninitialized slots, contiguous from the write position.
+  // Construct elements in the first k of them and publish them with
+  // commit(k). Fewer than n slots are returned when the queue is nearly full
+  // or the run reaches the end of the ring; reserve again after committing
+  // to get the rest.
+  span reserve(size_t n) noexcept {
+    auto const writeIdx = writeIdx_.load(std::memory_order_relaxed);
+    auto available = contiguousFree(writeIdx, readIdxCache_);
+    if (available < n) {
+      readIdxCache_ = readIdx_.load(std::memory_order_acquire);
+      available = contiguousFree(writeIdx, readIdxCache_);
+    }
+    return {&slots_[writeIdx + kPadding], available < n ? available : n};
+  }
+
+  void commit(size_t n) noexcept {
+    auto writeIdx = writeIdx_.load(std::memory_order_relaxed);
+    assert(n <= contiguousFree(writeIdx, readIdx_.load(std::memory_order_acquire)));
+    writeIdx += n;
+    if (writeIdx == capacity_) {
+      writeIdx = 0;
+    }
+    writeIdx_.store(writeIdx, std::memory_order_release);
+    published(writeIdx);
+  }
+
+  // Constructs as many of the count elements starting at first as fit, from
+  // *first, *++first and so on, and publishes them with a single index
+  // update. Returns how many were pushed. Pass a std::move_iterator to move
+  // the elements in.
+  template <typename InputIt>
+  size_t push_n(InputIt first, size_t count) noexcept(
+      std::is_nothrow_constructible<T, decltype(*first)>::value) {
+    auto const writeIdx = writeIdx_.load(std::memory_order_relaxed);
+    auto available = freeSlots(writeIdx, readIdxCache_);
+    if (available < count) {
+      readIdxCache_ = readIdx_.load(std::memory_order_acquire);
+      available = freeSlots(writeIdx, readIdxCache_);
+    }
+    if (available < count) {
+      count = available;
+    }
+    // Publishes whatever was constructed, even if a constructor throws.
+    struct Publisher {
+      SPSCQueue &queue;
+      size_t from;
+      size_t to;
+      ~Publisher() {
+        if (to != from) {
+          queue.writeIdx_.store(to, std::memory_order_release);
+          queue.published(to);
+        }
+      }
+    } publisher{*this, writeIdx, writeIdx};
+    for (size_t i = 0; i < count; ++i, ++first) {
+      new (&slots_[publisher.to + kPadding]) T(*first);
+      if (++publisher.to == capacity_) {
+        publisher.to = 0;
+      }
+    }
+    return count;
+  }
+
   T *front() noexcept {
     auto const readIdx = readIdx_.load(std::memory_order_relaxed);
     if (readIdx == writeIdxCache_) {
@@ -177,6 +555,73 @@ public:
       nextReadIdx = 0;
     }
     readIdx_.store(nextReadIdx, std::memory_order_release);
+    detail::notify(producerWaiting_, producerSeq_);
+  }
+
+  // Returns up to n of the elements ready to be consumed. Release them with
+  // pop_n once done.
+  spans front_n(size_t n) noexcept {
+    auto const readIdx = readIdx_.load(std::memory_order_relaxed);
+    if (occupied(readIdx, writeIdxCache_) < n) {
+      writeIdxCache_ = writeIdx_.load(std::memory_order_acquire);
+    }
+    auto const writeIdx = writeIdxCache_;
+    spans result{{&slots_[readIdx + kPadding], 0}, {&slots_[kPadding], 0}};
+    if (writeIdx >= readIdx) {
+      result.first.size = writeIdx - readIdx;
+    } else {
+      result.first.size = capacity_ - readIdx;
+      result.second.size = writeIdx;
+    }
+    if (result.first.size >= n) {
+      result.first.size = n;
+      result.second.size = 0;
+    } else if (result.size() > n) {
+      result.second.size = n - result.first.size;
+    }
+    return result;
+  }
+
+  // Destroys the n oldest elements and hands their slots back to the
+  // producer with a single index update.
+  void pop_n(size_t n) noexcept {
+    static_assert(std::is_nothrow_destructible<T>::value,
+                  "T must be nothrow destructible");
+    auto readIdx = readIdx_.load(std::memory_order_relaxed);
+    assert(n <= occupied(readIdx, writeIdx_.load(std::memory_order_acquire)));
+    if (n == 0) {
+      return;
+    }
+    if (std::is_trivially_destructible<T>::value) {
+      readIdx += n;
+      if (readIdx >= capacity_) {
+        readIdx -= capacity_;
+      }
+    } else {
+      for (size_t i = 0; i < n; ++i) {
+        slots_[readIdx + kPadding].~T();
+        if (++readIdx == capacity_) {
+          readIdx = 0;
+        }
+      }
+    }
+    readIdx_.store(readIdx, std::memory_order_release);
+    detail::notify(producerWaiting_, producerSeq_);
+  }
+
+  // Like front, but parks the thread for up to timeout while the queue is
+  // empty.
+  template <typename Rep, typename Period>
+  T *wait_front(const std::chrono::duration<Rep, Period> &timeout) noexcept {
+    if (T *element = front()) {
+      return element;
+    }
+    auto const stallStart = telemetry_.now();
+    detail::park(consumerWaiting_, consumerSeq_,
+                 [&] { return front() != nullptr; },
+                 detail::deadlineAfter(timeout));
+    telemetry_.emptyStall(stallStart);
+    return front();
   }
 
   size_t size() const noexcept {
@@ -192,6 +637,14 @@ public:
 
   size_t capacity() const noexcept { return capacity_ - 1; }
 
+  // Safe to call from any thread.
+  QueueStats stats() const noexcept {
+    QueueStats stats;
+    stats.depth = size();
+    telemetry_.read(stats);
+    return stats;
+  }
+
 private:
 #ifdef __cpp_lib_hardware_interference_size
   static constexpr size_t kCacheLineSize =
@@ -203,6 +656,37 @@ private:
   // Padding to avoid false sharing between slots_ and adjacent allocations
   static constexpr size_t kPadding = (kCacheLineSize - 1) / sizeof(T) + 1;
 
+  size_t occupied(size_t readIdx, size_t writeIdx) const noexcept {
+    return writeIdx >= readIdx ? writeIdx - readIdx
+                               : capacity_ - readIdx + writeIdx;
+  }
+
+  // One slot always stays empty to tell a full queue from an empty one.
+  size_t freeSlots(size_t writeIdx, size_t readIdx) const noexcept {
+    return capacity_ - 1 - occupied(readIdx, writeIdx);
+  }
+
+  size_t contiguousFree(size_t writeIdx, size_t readIdx) const noexcept {
+    if (readIdx > writeIdx) {
+      return readIdx - writeIdx - 1;
+    }
+    return capacity_ - writeIdx - (readIdx == 0 ? 1 : 0);
+  }
+
+  // Producer side, after publishing elements up to writeIdx.
+  void published(size_t writeIdx) noexcept {
+    detail::notify(consumerWaiting_, consumerSeq_);
+    if (telemetry_.above(occupied(readIdxCache_, writeIdx))) {
+      telemetry_.depth(
+          occupied(readIdx_.load(std::memory_order_relaxed), writeIdx));
+    }
+  }
+
+  bool hasSpaceFor(size_t nextWriteIdx) noexcept {
+    readIdxCache_ = readIdx_.load(std::memory_order_acquire);
+    return nextWriteIdx != readIdxCache_;
+  }
+
 private:
   size_t capacity_;
   T *slots_;
@@ -212,6 +696,14 @@ private:
   Allocator allocator_;
 #endif
 
+  // Parking state shares the read-mostly line with capacity_ and slots_. It
+  // is only written when a thread parks or wakes another one. The waiting
+  // words count parked threads, which is at most one here.
+  std::atomic<uint32_t> consumerWaiting_ = {0};
+  std::atomic<uint32_t> consumerSeq_ = {0};
+  std::atomic<uint32_t> producerWaiting_ = {0};
+  std::atomic<uint32_t> producerSeq_ = {0};
+
   // Align to cache line size in order to avoid false sharing
   // readIdxCache_ and writeIdxCache_ is used to reduce the amount of cache
   // coherency traffic
@@ -223,5 +715,11 @@ private:
   // Padding to avoid adjacent allocations to share cache line with
   // writeIdxCache_
   char padding_[kCacheLineSize - sizeof(writeIdxCache_)];
+
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+  detail::Telemetry telemetry_ [[no_unique_address]];
+#else
+  detail::Telemetry telemetry_;
+#endif
 };
 } // namespace rigtorp
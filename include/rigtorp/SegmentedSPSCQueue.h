@@ -0,0 +1,455 @@
+#pragma once
+
+#include <functional>
+#include <type_traits>
+
+#include "SPSCQueue.h" // detail::park, detail::notify
+
+namespace rigtorp {
+
+// Single-producer single-consumer queue that grows instead of blocking the
+// producer, with the same consumer interface as SPSCQueue.
+//
+// Elements live in a linked list of fixed-size segments. The consumer hands
+// drained segments back to the producer through a small pool, so a queue
+// that stays within a few segments allocates nothing once warm, and spare
+// segments beyond the pool are freed again.
+//
+// The producer only waits once the segments in use, plus what the queued
+// elements hold on the heap as HeapSize measures it, would exceed maxBytes.
+// HeapSize is called on each element right after it is constructed, and
+// the result counts until the element is popped. The last element pushed
+// may take the total past maxBytes. The ceiling hook then runs on the
+// producer thread, once each time the ceiling is hit, before emplace and
+// push park until the consumer frees memory. try_emplace and push_n return
+// instead. With heap memory counted, the hook only runs again once the
+// total has fallen below half of maxBytes, so a reader that keeps up just
+// barely does not set it off for every element.
+struct NoHeapSize {
+  template <typename U> size_t operator()(const U &) const noexcept {
+    return 0;
+  }
+};
+
+template <typename T, size_t SegmentSize = 256,
+          typename HeapSize = NoHeapSize>
+class SegmentedSPSCQueue {
+  static_assert(SegmentSize > 0, "");
+
+  static constexpr bool kCountsHeap = !std::is_same<HeapSize, NoHeapSize>::value;
+
+  struct Segment {
+    std::atomic<Segment *> next = {nullptr};
+    // Published by the producer: slots [0, written) hold elements.
+    std::atomic<size_t> written = {0};
+    // What HeapSize said each element held when it was pushed, so popping
+    // an element that was moved from still frees the right amount.
+    size_t heapSize[kCountsHeap ? SegmentSize : 1];
+    alignas(T) unsigned char storage[SegmentSize * sizeof(T)];
+
+    T *slot(size_t i) noexcept { return reinterpret_cast<T *>(storage) + i; }
+  };
+
+public:
+  struct span {
+    T *data;
+    size_t size;
+  };
+
+  // Elements in FIFO order: all of first, then all of second. second is only
+  // non-empty when the elements continue in the next segment.
+  struct spans {
+    span first;
+    span second;
+
+    size_t size() const noexcept { return first.size + second.size; }
+  };
+
+  // Called with the bytes in use when the ceiling is hit.
+  using CeilingHook = std::function<void(size_t)>;
+
+  // Always allows at least two segments, and one element with any heap
+  // size, whatever maxBytes says.
+  explicit SegmentedSPSCQueue(size_t maxBytes, CeilingHook onCeiling = {},
+                              HeapSize heapSize = HeapSize())
+      : maxBytes_(maxBytes),
+        maxSegments_(maxBytes / sizeof(Segment) < 2
+                         ? 2
+                         : maxBytes / sizeof(Segment)),
+        onCeiling_(std::move(onCeiling)), heapSizeOf_(std::move(heapSize)),
+        pool_(kSpareSegments) {
+    head_ = tail_ = new Segment;
+    segments_.store(1, std::memory_order_relaxed);
+  }
+
+  ~SegmentedSPSCQueue() {
+    while (front()) {
+      pop();
+    }
+    delete head_;
+    while (Segment **spare = pool_.front()) {
+      delete *spare;
+      pool_.pop();
+    }
+  }
+
+  // non-copyable and non-movable
+  SegmentedSPSCQueue(const SegmentedSPSCQueue &) = delete;
+  SegmentedSPSCQueue &operator=(const SegmentedSPSCQueue &) = delete;
+
+  template <typename... Args> void emplace(Args &&...args) {
+    while (!try_emplace(std::forward<Args>(args)...)) {
+      auto const stallStart = telemetry_.now();
+      detail::park(producerWaiting_, producerSeq_,
+                   [&] { return canPush(); },
+                   std::chrono::steady_clock::time_point::max());
+      telemetry_.fullStall(stallStart);
+    }
+  }
+
+  // Like emplace, but parks the thread for at most timeout at the memory
+  // ceiling and returns false if the reader made no room by then.
+  template <typename Rep, typename Period, typename... Args>
+  bool wait_emplace(const std::chrono::duration<Rep, Period> &timeout,
+                    Args &&...args) {
+    auto const deadline = detail::deadlineAfter(timeout);
+    while (!try_emplace(std::forward<Args>(args)...)) {
+      auto const stallStart = telemetry_.now();
+      bool const ready = detail::park(producerWaiting_, producerSeq_,
+                                      [&] { return canPush(); }, deadline);
+      telemetry_.fullStall(stallStart);
+      if (!ready) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Returns false only at the memory ceiling.
+  template <typename... Args> bool try_emplace(Args &&...args) {
+    if (!heapRoom() || (writeIdx_ == SegmentSize && !advance())) {
+      return false;
+    }
+    new (tail_->slot(writeIdx_)) T(std::forward<Args>(args)...);
+    countHeap();
+    ++writeIdx_;
+    publish(1);
+    return true;
+  }
+
+  template <typename P, typename = typename std::enable_if<
+                            std::is_constructible<T, P &&>::value>::type>
+  void push(P &&v) {
+    emplace(std::forward<P>(v));
+  }
+
+  template <typename P, typename = typename std::enable_if<
+                            std::is_constructible<T, P &&>::value>::type>
+  bool try_push(P &&v) {
+    return try_emplace(std::forward<P>(v));
+  }
+
+  template <typename Rep, typename Period, typename P,
+            typename = typename std::enable_if<
+                std::is_constructible<T, P &&>::value>::type>
+  bool wait_push(P &&v, const std::chrono::duration<Rep, Period> &timeout) {
+    return wait_emplace(timeout, std::forward<P>(v));
+  }
+
+  // Constructs the count elements starting at first, from *first, *++first
+  // and so on, publishing each segment once. Returns how many were pushed,
+  // which is less than count only at the memory ceiling.
+  template <typename InputIt> size_t push_n(InputIt first, size_t count) {
+    size_t pushed = 0;
+    size_t unpublished = 0;
+    try {
+      while (pushed < count) {
+        if (!heapRoom()) {
+          break;
+        }
+        if (writeIdx_ == SegmentSize) {
+          publish(unpublished);
+          unpublished = 0;
+          if (!advance()) {
+            break;
+          }
+        }
+        new (tail_->slot(writeIdx_)) T(*first);
+        countHeap();
+        ++first;
+        ++writeIdx_;
+        ++pushed;
+        ++unpublished;
+      }
+    } catch (...) {
+      publish(unpublished);
+      throw;
+    }
+    publish(unpublished);
+    return pushed;
+  }
+
+  T *front() noexcept {
+    if (readIdx_ == SegmentSize && !nextSegment()) {
+      return nullptr;
+    }
+    if (readIdx_ == writtenCache_) {
+      writtenCache_ = head_->written.load(std::memory_order_acquire);
+      if (readIdx_ == writtenCache_) {
+        return nullptr;
+      }
+    }
+    return head_->slot(readIdx_);
+  }
+
+  void pop() noexcept { pop_n(1); }
+
+  // Returns up to n of the elements ready to be consumed. Release them with
+  // pop_n once done.
+  spans front_n(size_t n) noexcept {
+    spans result{{nullptr, 0}, {nullptr, 0}};
+    if (!front()) {
+      return result;
+    }
+    if (writtenCache_ - readIdx_ < n && writtenCache_ != SegmentSize) {
+      writtenCache_ = head_->written.load(std::memory_order_acquire);
+    }
+    result.first = {head_->slot(readIdx_), writtenCache_ - readIdx_};
+    if (result.first.size >= n) {
+      result.first.size = n;
+      return result;
+    }
+    if (writtenCache_ == SegmentSize) {
+      if (Segment *next = head_->next.load(std::memory_order_acquire)) {
+        auto const written = next->written.load(std::memory_order_acquire);
+        auto const wanted = n - result.first.size;
+        result.second = {next->slot(0), written < wanted ? written : wanted};
+      }
+    }
+    return result;
+  }
+
+  // Destroys the n oldest elements, handing drained segments back to the
+  // producer.
+  void pop_n(size_t n) noexcept {
+    static_assert(std::is_nothrow_destructible<T>::value,
+                  "T must be nothrow destructible");
+    size_t freed = 0;
+    for (size_t i = 0; i < n; ++i) {
+      if (readIdx_ == SegmentSize) {
+        bool const advanced = nextSegment();
+        assert(advanced);
+        (void)advanced;
+      }
+      assert(readIdx_ < head_->written.load(std::memory_order_acquire));
+      if (kCountsHeap) {
+        freed += head_->heapSize[readIdx_];
+      }
+      head_->slot(readIdx_)->~T();
+      ++readIdx_;
+    }
+    popped_.store(popped_.load(std::memory_order_relaxed) + n,
+                  std::memory_order_release);
+    if (freed != 0) {
+      heapBytes_.fetch_sub(freed, std::memory_order_release);
+      detail::notify(producerWaiting_, producerSeq_);
+    }
+  }
+
+  // Like front, but parks the thread for up to timeout while the queue is
+  // empty.
+  template <typename Rep, typename Period>
+  T *wait_front(const std::chrono::duration<Rep, Period> &timeout) noexcept {
+    if (T *element = front()) {
+      return element;
+    }
+    auto const stallStart = telemetry_.now();
+    detail::park(consumerWaiting_, consumerSeq_,
+                 [&] { return front() != nullptr; },
+                 detail::deadlineAfter(timeout));
+    telemetry_.emptyStall(stallStart);
+    return front();
+  }
+
+  size_t size() const noexcept {
+    auto const popped = popped_.load(std::memory_order_acquire);
+    return pushed_.load(std::memory_order_acquire) - popped;
+  }
+
+  bool empty() const noexcept { return size() == 0; }
+
+  // Bytes held in segments, including the spare ones, and on the heap by
+  // the queued elements.
+  size_t memory() const noexcept {
+    return segments_.load(std::memory_order_relaxed) * sizeof(Segment) +
+           heapBytes_.load(std::memory_order_relaxed);
+  }
+
+  size_t max_memory() const noexcept { return maxBytes_; }
+
+  // Safe to call from any thread.
+  QueueStats stats() const noexcept {
+    QueueStats stats;
+    stats.depth = size();
+    telemetry_.read(stats);
+    return stats;
+  }
+
+private:
+#ifdef __cpp_lib_hardware_interference_size
+  static constexpr size_t kCacheLineSize =
+      std::hardware_destructive_interference_size;
+#else
+  static constexpr size_t kCacheLineSize = 64;
+#endif
+
+  // Drained segments kept for reuse; the rest are freed.
+  static constexpr size_t kSpareSegments = 4;
+
+  void publish(size_t count) noexcept {
+    if (count == 0) {
+      return;
+    }
+    tail_->written.store(writeIdx_, std::memory_order_release);
+    auto const pushed = pushed_.load(std::memory_order_relaxed) + count;
+    pushed_.store(pushed, std::memory_order_release);
+    detail::notify(consumerWaiting_, consumerSeq_);
+    if (detail::Telemetry::enabled) {
+      telemetry_.depth(pushed - popped_.load(std::memory_order_relaxed));
+    }
+  }
+
+  bool canGrow() noexcept {
+    return !pool_.empty() ||
+           segments_.load(std::memory_order_acquire) < maxSegments_;
+  }
+
+  // Whether the elements' heap memory leaves room for one more. Always true
+  // while none is counted, so an element bigger than maxBytes still goes
+  // through once the queue has drained.
+  bool underHeapCeiling() const noexcept {
+    if (!kCountsHeap) {
+      return true;
+    }
+    auto const heap = heapBytes_.load(std::memory_order_acquire);
+    return heap == 0 ||
+           heap + segments_.load(std::memory_order_relaxed) * sizeof(Segment) <
+               maxBytes_;
+  }
+
+  bool canPush() noexcept {
+    return underHeapCeiling() && (writeIdx_ < SegmentSize || canGrow());
+  }
+
+  // Producer side. Like underHeapCeiling, but runs the ceiling hook when
+  // it is hit.
+  bool heapRoom() {
+    if (underHeapCeiling()) {
+      return true;
+    }
+    ceilingHit();
+    return false;
+  }
+
+  // Producer side. Counts the element just constructed at writeIdx_.
+  void countHeap() noexcept {
+    if (kCountsHeap) {
+      auto const bytes = heapSizeOf_(*tail_->slot(writeIdx_));
+      tail_->heapSize[writeIdx_] = bytes;
+      heapBytes_.fetch_add(bytes, std::memory_order_relaxed);
+      if (atCeiling_ && memory() < maxBytes_ / 2) {
+        atCeiling_ = false;
+      }
+    }
+  }
+
+  void ceilingHit() {
+    if (!atCeiling_ && onCeiling_) {
+      onCeiling_(memory());
+    }
+    atCeiling_ = true;
+  }
+
+  // Producer side. Links a fresh segment after the full tail.
+  bool advance() {
+    Segment *next = nullptr;
+    if (Segment **spare = pool_.front()) {
+      next = *spare;
+      pool_.pop();
+    } else if (segments_.load(std::memory_order_acquire) < maxSegments_) {
+      next = new Segment;
+      segments_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      ceilingHit();
+      return false;
+    }
+    atCeiling_ = false;
+    tail_->next.store(next, std::memory_order_release);
+    tail_ = next;
+    writeIdx_ = 0;
+    return true;
+  }
+
+  // Consumer side. Moves past the drained head segment if the producer has
+  // linked another one.
+  bool nextSegment() noexcept {
+    Segment *next = head_->next.load(std::memory_order_acquire);
+    if (!next) {
+      return false;
+    }
+    recycle(head_);
+    head_ = next;
+    readIdx_ = 0;
+    writtenCache_ = next->written.load(std::memory_order_acquire);
+    return true;
+  }
+
+  void recycle(Segment *segment) noexcept {
+    segment->next.store(nullptr, std::memory_order_relaxed);
+    segment->written.store(0, std::memory_order_relaxed);
+    if (!pool_.try_push(segment)) {
+      delete segment;
+      segments_.fetch_sub(1, std::memory_order_release);
+    }
+    detail::notify(producerWaiting_, producerSeq_);
+  }
+
+  size_t const maxBytes_;
+  size_t const maxSegments_;
+  CeilingHook onCeiling_;
+  HeapSize heapSizeOf_;
+
+  // Drained segments travel from the consumer back to the producer.
+  SPSCQueue<Segment *> pool_;
+
+  // Only written when a thread parks or wakes another one.
+  std::atomic<uint32_t> consumerWaiting_ = {0};
+  std::atomic<uint32_t> consumerSeq_ = {0};
+  std::atomic<uint32_t> producerWaiting_ = {0};
+  std::atomic<uint32_t> producerSeq_ = {0};
+  std::atomic<size_t> segments_ = {0};
+  // What HeapSize counted for the elements pushed and not yet popped.
+  std::atomic<size_t> heapBytes_ = {0};
+
+  // Producer side.
+  alignas(kCacheLineSize) Segment *tail_;
+  size_t writeIdx_ = 0;
+  bool atCeiling_ = false;
+  std::atomic<size_t> pushed_ = {0};
+
+  // Consumer side.
+  alignas(kCacheLineSize) Segment *head_;
+  size_t readIdx_ = 0;
+  size_t writtenCache_ = 0;
+  std::atomic<size_t> popped_ = {0};
+
+  // Padding to avoid adjacent allocations to share cache line with popped_
+  char padding_[kCacheLineSize - 3 * sizeof(size_t) - sizeof(popped_)];
+
+#if defined(__has_cpp_attribute) && __has_cpp_attribute(no_unique_address)
+  detail::Telemetry telemetry_ [[no_unique_address]];
+#else
+  detail::Telemetry telemetry_;
+#endif
+};
+} // namespace rigtorp
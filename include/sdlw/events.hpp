@@ -387,6 +387,17 @@ inline void set_event_state(event_type etype, bool enable) noexcept
     SDL_EventState(static_cast<u32>(etype), static_cast<SDL_bool>(!enable));
 }
 
+// Reserves count consecutive event types for user events and returns the
+// first one.
+inline auto register_events(int count) -> event_type
+{
+    const auto first = SDL_RegisterEvents(count);
+    if (first == static_cast<u32>(-1)) {
+        throw error{};
+    }
+    return static_cast<event_type>(first);
+}
+
 class event_filter {
     SDL_EventFilter _filter = nullptr;
     void* _userdata = nullptr;
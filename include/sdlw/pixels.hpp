@@ -306,6 +306,11 @@ public:
     {
         return {_handle->Rmask, _handle->Gmask, _handle->Bmask, _handle->Amask};
     }
+
+    u32 map(color c) const noexcept
+    {
+        return SDL_MapRGBA(_handle, c.r, c.g, c.b, c.a);
+    }
 };
 
 struct pixel_format_ref : pixel_format {
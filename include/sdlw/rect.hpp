@@ -92,8 +92,8 @@ inline rect rect_union(const rect& r1, const rect& r2) noexcept
     auto a = reinterpret_cast<const SDL_Rect*>(&r1);
     auto b = reinterpret_cast<const SDL_Rect*>(&r2);
     SDL_Rect result;
-    SDL_UnionRect(a, a, &result);
-    return rect{result.x, result.x, result.w, result.h};
+    SDL_UnionRect(a, b, &result);
+    return rect{result.x, result.y, result.w, result.h};
 }
 
 } // namespace sdl
@@ -126,6 +126,14 @@ public:
 
     void set_target(texture&);
 
+    // Renders to the window again.
+    void reset_target()
+    {
+        if (SDL_SetRenderTarget(_handle, nullptr) < 0) {
+            throw error{};
+        }
+    }
+
     size output_size() const
     {
         sdl::size s;
@@ -88,6 +88,12 @@ public:
         return _handle->pitch;
     }
 
+    // Only valid while locked, if must_lock().
+    void* pixels() const noexcept
+    {
+        return _handle->pixels;
+    }
+
     void fill(const rect& r, u32 color)
     {
         auto rr = reinterpret_cast<const SDL_Rect*>(&r);
@@ -3,6 +3,8 @@
 
 #include <SDL_thread.h>
 
+#include <sdlw/error.hpp>
+
 namespace sdl {
 
 enum class thread_id : SDL_threadID {};
@@ -10,7 +12,8 @@ enum class thread_id : SDL_threadID {};
 enum class thread_priority {
     low    = SDL_THREAD_PRIORITY_LOW,
     normal = SDL_THREAD_PRIORITY_NORMAL,
-    high   = SDL_THREAD_PRIORITY_HIGH
+    high          = SDL_THREAD_PRIORITY_HIGH,
+    time_critical = SDL_THREAD_PRIORITY_TIME_CRITICAL
 };
 
 class thread {
@@ -19,11 +22,30 @@ class thread {
 public:
     ~thread()
     {
-        wait();
+        if (_handle) wait();
     }
 
     thread() = default;
 
+    thread(const thread&) = delete;
+    thread& operator=(const thread&) = delete;
+
+    thread(thread&& other) noexcept
+        : _handle(other._handle)
+    {
+        other._handle = nullptr;
+    }
+
+    thread& operator=(thread&& other) noexcept
+    {
+        if (this != &other) {
+            if (_handle) wait();
+            _handle = other._handle;
+            other._handle = nullptr;
+        }
+        return *this;
+    }
+
     template <typename Function>
     thread(const char* name, Function&& f)
     {
@@ -35,8 +57,11 @@ public:
             delete fn;
             return status;
         };
-        _handle = SDL_CreateThread(thread_function, name);
-        if (!_handle) throw error{};
+        _handle = SDL_CreateThread(thread_function, name, function);
+        if (!_handle) {
+            delete function;
+            throw error{};
+        }
     }
 
     thread_id id() const noexcept
@@ -49,6 +74,8 @@ public:
         return SDL_GetThreadName(_handle);
     }
 
+    // SDL only sets the priority of the calling thread, whichever thread
+    // this object refers to.
     void set_priority(thread_priority p) noexcept
     {
         SDL_SetThreadPriority(static_cast<SDL_ThreadPriority>(p));
@@ -57,18 +84,26 @@ public:
     void detach() noexcept
     {
         SDL_DetachThread(_handle);
+        _handle = nullptr;
     }
 
     int wait() noexcept
     {
-        int status;
+        int status = 0;
         SDL_WaitThread(_handle, &status);
+        _handle = nullptr;
         return status;
     }
 };
 
 struct this_thread {
-    static thread_id id() { return SDL_ThreadID(); }
+    static thread_id id() { return static_cast<thread_id>(SDL_ThreadID()); }
+
+    // Fails without permission, e.g. raising priority as a normal user.
+    static bool set_priority(thread_priority p) noexcept
+    {
+        return SDL_SetThreadPriority(static_cast<SDL_ThreadPriority>(p)) == 0;
+    }
 };
 
 } // namespace sdl
@@ -70,7 +70,10 @@ struct high_resolution_clock {
     {
         static const auto frequency = SDL_GetPerformanceFrequency();
         const auto counter = SDL_GetPerformanceCounter();
-        return time_point{duration{counter * std::nano::den / frequency}};
+        // Split so counter * den cannot overflow.
+        const auto seconds = counter / frequency;
+        const auto rest = counter % frequency;
+        return time_point{duration{seconds * std::nano::den + rest * std::nano::den / frequency}};
     }
 };
 
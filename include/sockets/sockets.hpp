@@ -1,3 +1,5 @@
+#pragma once
+
 #include <cassert>
 #include <cstddef>
 #include <stdexcept>
@@ -156,6 +158,13 @@ public:
         if (n == -1) throw_wsa_error("send");
     }
 
+    // Safe to call while another thread is blocked sending or receiving,
+    // which then returns. how is SD_RECEIVE, SD_SEND or SD_BOTH.
+    void shutdown(int how) noexcept
+    {
+        ::shutdown(sockfd, how);
+    }
+
     std::string receive()
     {
         std::string data;
@@ -166,6 +175,67 @@ public:
         data.append(buffer, bytes_received);
         return data;
     }
+
+    SOCKET native_handle() const
+    {
+        return sockfd;
+    }
+
+    void set_nonblocking(bool nonblocking)
+    {
+        u_long mode = nonblocking ? 1 : 0;
+        if (::ioctlsocket(sockfd, FIONBIO, &mode) != 0) throw_wsa_error("ioctlsocket");
+    }
+
+    // For nonblocking sockets. Starts connecting to address and returns
+    // true if that finished at once. Otherwise the socket becomes writable
+    // once the connection is made or has failed; call finish_connect then.
+    bool try_connect(const ::sockaddr* address, int length)
+    {
+        if (::connect(sockfd, address, length) == 0) return true;
+        if (WSAGetLastError() == WSAEWOULDBLOCK) return false;
+        throw_wsa_error("connect");
+        return false;
+    }
+
+    // Throws if the connection try_connect started has failed.
+    void finish_connect()
+    {
+        int error = 0;
+        int length = sizeof error;
+        if (::getsockopt(sockfd, SOL_SOCKET, SO_ERROR, (char*)&error, &length) != 0) throw_wsa_error("getsockopt");
+        if (error != 0) {
+            WSASetLastError(error);
+            throw_wsa_error("connect");
+        }
+    }
+
+    // For nonblocking sockets. Returns the number of bytes sent, 0 if the
+    // call would block.
+    std::size_t try_send(const char* data, std::size_t size)
+    {
+        int n = ::send(sockfd, data, static_cast<int>(size), 0);
+        if (n == -1) {
+            if (WSAGetLastError() == WSAEWOULDBLOCK) return 0;
+            throw_wsa_error("send");
+        }
+        return static_cast<std::size_t>(n);
+    }
+
+    // For nonblocking sockets. Appends what was received to data. Returns
+    // false if the call would block; an empty read means the peer closed
+    // the connection.
+    bool try_receive(std::string& data)
+    {
+        char buffer[4096];
+        int bytes_received = ::recv(sockfd, buffer, 4096, 0);
+        if (bytes_received == -1) {
+            if (WSAGetLastError() == WSAEWOULDBLOCK) return false;
+            throw_wsa_error("recv");
+        }
+        data.append(buffer, bytes_received);
+        return true;
+    }
 };
 
 class tcp_server_socket {
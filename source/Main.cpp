@@ -1,44 +1,757 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
 #include <thread>
+#include <type_traits>
+#include <variant>
+#include <vector>
 
 #include <sdlw/sdlw.hpp>
 #include <sdlw/image.hpp>
 #include <sdlw/ttf.hpp>
 #include <json/json.hpp>
 
+#include "canvas/Canvas.h"
+#include "canvas/FrameScheduler.h"
+#include "canvas/Headless.h"
+#include "canvas/Simplifier.h"
+#include "client/Bots.h"
 #include "client/Client.h"
+#include "protocol/Protocol.h"
+#include "threading/Benchmarks.h"
+#include "threading/ThreadPool.h"
 
 using namespace nlohmann;
 
-void read_messages()
-try {
-	json message;
-	for (;;) {
-		if (next_message(message)) {
-			std::cout << message.dump(2) << "\n" << std::endl;
+static constexpr std::chrono::seconds shutdown_drain_time{ 2 };
+
+// Thins out the mouse samples of strokes drawn here before they are sent.
+// Only used on the main thread.
+static stroke_simplifier simplifier;
+static std::vector<sdl::point> simplified;
+static constexpr sdl::color pen_color{ 0, 0, 0, 255 };
+// How far each channel may be from the clicked pixel's for the paint
+// bucket to spread, enough to take in the anti-aliased edges of strokes.
+static constexpr proto::integer fill_tolerance = 48;
+
+// Who is playing here and who is drawing this round, to know whether to
+// answer snapshot requests. Only used on the main thread.
+static std::string own_username;
+static std::string drawer;
+
+// Snapshots are sent in parts of at most this many characters, well below
+// connection::max_frame_size.
+static constexpr std::size_t snapshot_part_size = 32 * 1024;
+// The parts of a snapshot received so far. Only used on the main thread.
+static std::string snapshot_parts;
+static proto::integer next_snapshot_part = 0;
+
+// When the receiver last handed over messages, so the frame report counts
+// the time they took to reach the main thread too.
+static std::atomic<frame_scheduler::clock::time_point> messages_received_at;
+
+void request_snapshot()
+{
+	send_message(proto::to_json(proto::snapshot_request_message{}));
+}
+
+// What the drawer sends while snapshots are being encoded, in order: a
+// snapshot waits at the place it was taken until it is encoded, and the
+// drawing messages after it wait behind it, so whoever asked for it
+// continues right after it. Only used on the main thread.
+struct outgoing {
+	// A drawing message, or else a snapshot taken at sequence.
+	std::optional<json> message;
+	std::size_t snapshot = 0;
+	std::size_t sequence = 0;
+	std::optional<std::string> encoded;
+};
+static std::deque<outgoing> outbox;
+static std::size_t next_snapshot = 1;
+
+void send_encoded_snapshot(const std::string& encoded, std::size_t sequence)
+{
+	if (encoded.empty()) {
+		std::cerr << "The canvas is too big to send as a snapshot." << std::endl;
+		return;
+	}
+	const std::size_t parts = (encoded.size() + snapshot_part_size - 1) / snapshot_part_size;
+	for (std::size_t i = 0; i < parts; ++i) {
+		proto::snapshot_message part;
+		part.sequence = static_cast<proto::integer>(sequence);
+		part.part = static_cast<proto::integer>(i);
+		part.parts = static_cast<proto::integer>(parts);
+		part.canvas = std::string_view{ encoded }.substr(i * snapshot_part_size, snapshot_part_size);
+		send_message(proto::to_json(part));
+	}
+}
+
+// Sends what waits in the outbox, up to the first snapshot not yet encoded.
+void flush_outbox()
+{
+	for (; !outbox.empty(); outbox.pop_front()) {
+		outgoing& next = outbox.front();
+		if (next.message) {
+			send_message(std::move(*next.message));
+		}
+		else if (next.encoded) {
+			send_encoded_snapshot(*next.encoded, next.sequence);
+		}
+		else {
+			return;
 		}
 	}
 }
-catch (const std::exception& e) {
-	std::cerr << "Error reading messages: " << e.what() << std::endl;
+
+// Sends a drawing message made here, after any snapshot still in the works.
+void send_drawing(json message)
+{
+	if (outbox.empty()) {
+		send_message(std::move(message));
+		return;
+	}
+	outbox.push_back({ std::move(message) });
 }
 
-int main(int argc, char* argv[])
-try {
-	start_client();
+// Takes the snapshot here, but encodes it on a worker, as that takes
+// milliseconds on a busy canvas, and sends it once back on this thread.
+void send_snapshot(const canvas& board)
+{
+	const std::size_t id = next_snapshot++;
+	outbox.push_back({ std::nullopt, id, board.sequence() });
+	shared_pool().submit([snapshot = board.snapshot(), id] {
+		std::string encoded = encode_snapshot(snapshot);
+		shared_pool().post_main([encoded = std::move(encoded), id]() mutable {
+			for (outgoing& waiting : outbox) {
+				if (waiting.snapshot == id) {
+					waiting.encoded = std::move(encoded);
+				}
+			}
+			flush_outbox();
+		});
+	});
+}
 
-	std::thread{ read_messages }.detach();
+// Collects the parts of a snapshot and loads it once all have arrived. A
+// part out of order drops what was collected, and so does a snapshot
+// longer than one of this canvas can be.
+void receive_snapshot(const proto::snapshot_message& part, canvas& board)
+{
+	const auto max_parts = static_cast<proto::integer>((max_snapshot_text(board.size()) + snapshot_part_size - 1) / snapshot_part_size);
+	if (part.parts < 1 || part.parts > max_parts || part.canvas.size() > snapshot_part_size) {
+		std::cerr << "Ignoring a malformed canvas snapshot." << std::endl;
+		snapshot_parts.clear();
+		next_snapshot_part = 0;
+		return;
+	}
+	if (part.part != next_snapshot_part) {
+		snapshot_parts.clear();
+		next_snapshot_part = 0;
+		if (part.part != 0) {
+			return;
+		}
+	}
+	snapshot_parts += part.canvas;
+	if (++next_snapshot_part < part.parts) {
+		return;
+	}
+	canvas_snapshot snapshot;
+	if (!decode_snapshot(snapshot_parts, board.size(), snapshot) || !board.load(snapshot, static_cast<std::size_t>(part.sequence))) {
+		std::cerr << "Ignoring a malformed canvas snapshot." << std::endl;
+	}
+	snapshot_parts.clear();
+	next_snapshot_part = 0;
+}
+
+// Messages that change the canvas and are counted in its sequence.
+template <class Message>
+constexpr bool is_drawing = std::is_same_v<Message, proto::line_message> || std::is_same_v<Message, proto::end_line_message>
+	|| std::is_same_v<Message, proto::fill_message> || std::is_same_v<Message, proto::undo_message>
+	|| std::is_same_v<Message, proto::redo_message>;
+
+// Draws lines on the canvas and prints everything else.
+void handle_messages(std::vector<incoming_message>& messages, canvas& board)
+{
+	constexpr std::size_t max_batch = 256;
+	std::size_t count;
+	do {
+		count = next_messages(messages, max_batch);
+		for (const incoming_message& message : messages) {
+			std::visit([&](const auto& m) {
+				using type = std::decay_t<decltype(m)>;
+				if constexpr (std::is_same_v<type, proto::undo_message>) {
+					// The drawer only sends undo when it has something to
+					// undo, so this canvas has fallen behind theirs.
+					if (!board.can_undo()) {
+						request_snapshot();
+						return;
+					}
+					board.apply(m);
+					return;
+				}
+				else if constexpr (is_drawing<type>) {
+					board.apply(m);
+					return;
+				}
+				else if constexpr (std::is_same_v<type, proto::snapshot_request_message>) {
+					if (!own_username.empty() && own_username == drawer) {
+						send_snapshot(board);
+					}
+					return;
+				}
+				else if constexpr (std::is_same_v<type, proto::snapshot_message>) {
+					receive_snapshot(m, board);
+					return;
+				}
+				else if constexpr (std::is_same_v<type, proto::game_started_message>) {
+					board.clear();
+					drawer = m.drawer;
+				}
+				std::cout << proto::to_json(message.message).dump(2) << "\n\n";
+			}, message.message);
+		}
+		messages.clear();
+	} while (count == max_batch);
+	std::cout << std::flush;
+}
+
+void draw_frame(sdl::renderer& renderer, canvas& board)
+{
+	renderer.set_draw_color({ 0, 0, 0, 255 });
+	renderer.clear();
+	board.render();
+	renderer.present();
+}
 
+void print_queue_stats(const char* name, const rigtorp::QueueStats& stats)
+{
+	std::cout << name << " queue: " << stats.depth << " queued, high-water mark " << stats.high_water << "\n";
+	std::cout << name << " queue stalls: " << stats.full_stalls << " full (" << stats.full_stall_nanoseconds / 1e6 << " ms), "
+		<< stats.empty_stalls << " empty (" << stats.empty_stall_nanoseconds / 1e6 << " ms)\n";
+}
+
+void print_stats(const client_stats& stats)
+{
+	if (stats.negotiated) {
+		std::cout << "Codec: " << proto::name(stats.settings.codec) << "\n";
+		std::cout << "Compression: " << proto::name(stats.settings.compression) << "\n";
+		std::cout << "Max batch: " << stats.settings.max_batch << "\n";
+	}
+	else {
+		std::cout << "Codec: json (server did not negotiate)\n";
+	}
+	const auto& compression = stats.compression;
+	if (compression.compressed_sent != 0) {
+		double megabytes = compression.raw_sent / 1e6;
+		std::cout << "Sent compression ratio: " << double(compression.raw_sent) / compression.compressed_sent << "\n";
+		std::cout << "Compression CPU: " << compression.compress_nanoseconds / 1e6 / megabytes << " ms/MB\n";
+	}
+	if (compression.compressed_received != 0) {
+		double megabytes = compression.raw_received / 1e6;
+		std::cout << "Received compression ratio: " << double(compression.raw_received) / compression.compressed_received << "\n";
+		std::cout << "Decompression CPU: " << compression.decompress_nanoseconds / 1e6 / megabytes << " ms/MB\n";
+	}
+	std::cout << "Accepted messages: " << stats.ingest.accepted << "\n";
+	std::cout << "Oversized frames: " << stats.ingest.oversized << "\n";
+	for (std::size_t i = 1; i < stats.ingest.rejected.size(); ++i) {
+		if (stats.ingest.rejected[i] != 0) {
+			auto error = static_cast<proto::error>(i);
+			std::cout << "Rejected (" << proto::describe(error) << "): " << stats.ingest.rejected[i] << "\n";
+		}
+	}
+	print_queue_stats("Incoming", stats.incoming_queue);
+	print_queue_stats("Outgoing", stats.outgoing_queue);
+	const auto& strokes = simplifier.totals();
+	if (strokes.points_in != 0) {
+		std::cout << "Stroke points: " << strokes.points_in << " drawn, " << strokes.points_out << " sent ("
+			<< 100.0 * strokes.points_out / strokes.points_in << "%)\n";
+	}
+	std::cout << std::endl;
+}
+
+sdl::point to_canvas(sdl::renderer& renderer, const canvas& board, int x, int y)
+{
+	sdl::size window = renderer.output_size();
+	sdl::size size = board.size();
+	return { x * size.width / std::max(window.width, 1), y * size.height / std::max(window.height, 1) };
+}
+
+// Sends the simplified points and draws them here too, as the server does
+// not echo them back.
+void send_stroke_points(canvas& board)
+{
+	for (sdl::point point : simplified) {
+		proto::line_message line;
+		line.x = point.x;
+		line.y = point.y;
+		line.r = pen_color.r;
+		line.g = pen_color.g;
+		line.b = pen_color.b;
+		line.a = pen_color.a;
+		board.apply(line);
+		send_drawing(proto::to_json(line));
+	}
+	simplified.clear();
+}
+
+void draw_stroke_point(canvas& board, sdl::point point)
+{
+	simplifier.add(point, simplified);
+	send_stroke_points(board);
+}
+
+void end_stroke(canvas& board)
+{
+	simplifier.finish(simplified);
+	send_stroke_points(board);
+	proto::end_line_message end;
+	board.apply(end);
+	send_drawing(proto::to_json(end));
+}
+
+// Fills around point here and on every other canvas.
+void send_fill(canvas& board, sdl::point point)
+{
+	proto::fill_message fill;
+	fill.x = point.x;
+	fill.y = point.y;
+	fill.r = pen_color.r;
+	fill.g = pen_color.g;
+	fill.b = pen_color.b;
+	fill.a = pen_color.a;
+	fill.tolerance = fill_tolerance;
+	board.apply(fill);
+	send_drawing(proto::to_json(fill));
+}
+
+// Applies an undo or redo here and sends it on, as the server does not
+// echo it back either.
+template <class Message>
+void send_history_step(canvas& board)
+{
+	Message step;
+	board.apply(step);
+	send_drawing(proto::to_json(step));
+}
+
+void print_frame_report(const frame_scheduler::report& report)
+{
+	using milliseconds = std::chrono::duration<double, std::milli>;
+	const double seconds = std::chrono::duration<double>(report.period).count();
+	std::cout << "Frames: " << report.frames << " in " << seconds << " s (" << (seconds > 0 ? report.frames / seconds : 0) << " fps), "
+		<< report.coalesced << " changes drawn together\n";
+	std::cout << "Frame time: " << milliseconds(report.average).count() << " ms average, " << milliseconds(report.worst).count() << " ms worst, "
+		<< milliseconds(report.budget).count() << " ms budget, " << report.over_budget << " over\n";
+	std::cout << "Drawing: " << report.busy * 100 << "% of the time\n";
+	std::cout << "Change to screen: " << milliseconds(report.latency_median).count() << " ms median, "
+		<< milliseconds(report.latency_99th).count() << " ms 99th percentile, " << milliseconds(report.latency_worst).count() << " ms worst\n" << std::endl;
+}
+
+// Safe to call from any thread, and never throws, as the receiver and pool
+// workers wake the main loop with it. Returns false, after saying why, if
+// SDL could not queue the event.
+bool push_event(sdl::event_type type)
+{
+	sdl::event event;
+	event.user = {};
+	event.type = type;
+	if (SDL_PushEvent(reinterpret_cast<SDL_Event*>(&event)) == 1) {
+		return true;
+	}
+	std::cerr << "Cannot wake the main loop. " << SDL_GetError() << std::endl;
+	return false;
+}
+
+// print_hashes and print_frames run on the main thread for /hash and
+// /frames.
+void read_commands(std::function<void()> print_hashes, std::function<void()> print_frames)
+try {
 	std::string line;
 	while (std::getline(std::cin, line)) {
+		if (line == "/stats") {
+			// The stroke totals belong to the main thread.
+			shared_pool().post_main([] { print_stats(get_client_stats()); });
+			continue;
+		}
+		if (line == "/hash") {
+			shared_pool().post_main(print_hashes);
+			continue;
+		}
+		if (line == "/frames") {
+			shared_pool().post_main(print_frames);
+			continue;
+		}
 		json message;
 		try {
 			message = json::parse(line);
 		}
 		catch (const json::parse_error& e) {
 			std::cerr << "Invalid JSON. " << e.what() << std::endl;
+			continue;
 		}
+		if (auto error = proto::validate(message, proto::direction::to_server); error != proto::error::none) {
+			std::cerr << "Invalid message. " << proto::describe(error) << std::endl;
+			continue;
+		}
+		if (message["type"] != proto::username_message::wire_name) {
+			send_message(std::move(message));
+			continue;
+		}
+		std::string username = message["username"].get<std::string>();
 		send_message(std::move(message));
+		// Nobody answers a request sent before joining, so ask for the
+		// canvas of a round already going on once the username is out.
+		shared_pool().post_main([username = std::move(username)] {
+			if (own_username.empty()) {
+				request_snapshot();
+			}
+			own_username = username;
+		});
+	}
+	push_event(sdl::event_type::quit);
+}
+catch (const std::exception& e) {
+	std::cerr << "Error reading commands: " << e.what() << std::endl;
+}
+
+// Prints the hash of the canvas and, without a window, of the last frame,
+// for comparing what different builds or machines draw.
+void print_hashes(const canvas& board, headless_target* headless)
+{
+	std::cout << "Canvas hash: " << std::hex << pixel_hash(board.pixels()) << std::dec << " (" << stroke_rasterizer::name(board.kernel()) << " strokes)\n";
+	if (headless) {
+		std::cout << "Frame hash: " << std::hex << headless->hash() << std::dec << "\n";
+	}
+	std::cout << std::endl;
+}
+
+// Draws the messages in an NDJSON file of messages from the server, a frame
+// per batch as if they had just arrived, then prints how long that took and
+// the resulting hashes. Needs no server.
+//
+// With compare_kernels it also draws them with every other stroke kernel
+// this CPU supports, and fails unless all of them drew the same pixels.
+int replay(const char* path, sdl::renderer& renderer, canvas& board, headless_target* headless, bool compare_kernels)
+{
+	constexpr std::size_t batch_size = 256;
+
+	std::ifstream file{ path };
+	if (!file) {
+		std::cerr << "Cannot open " << path << "." << std::endl;
+		return 1;
+	}
+	// The messages point into their lines, so keep those.
+	std::vector<std::string> lines;
+	std::vector<proto::message> messages;
+	for (std::string line; std::getline(file, line);) {
+		lines.push_back(std::move(line));
+	}
+	for (std::string& line : lines) {
+		proto::message message;
+		if (auto error = proto::parse_text(line.data(), line.data() + line.size(), proto::direction::from_server, message); error != proto::error::none) {
+			std::cerr << "Skipping an invalid message. " << proto::describe(error) << std::endl;
+			continue;
+		}
+		messages.push_back(message);
+	}
+
+	std::vector<std::unique_ptr<canvas>> others;
+	if (compare_kernels) {
+		for (auto kernel : { stroke_rasterizer::kernel::scalar, stroke_rasterizer::kernel::sse2, stroke_rasterizer::kernel::avx2 }) {
+			if (kernel != board.kernel() && stroke_rasterizer::supported(kernel)) {
+				others.push_back(std::make_unique<canvas>(renderer, board.size(), kernel));
+			}
+		}
+	}
+	const auto apply = [](canvas& target, const proto::message& message) {
+		std::visit([&](const auto& m) {
+			using type = std::decay_t<decltype(m)>;
+			if constexpr (is_drawing<type>) {
+				target.apply(m);
+			}
+			else if constexpr (std::is_same_v<type, proto::game_started_message>) {
+				target.clear();
+			}
+		}, message);
+	};
+
+	std::size_t frames = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < messages.size(); i += batch_size) {
+		for (std::size_t j = i; j < std::min(i + batch_size, messages.size()); ++j) {
+			apply(board, messages[j]);
+		}
+		draw_frame(renderer, board);
+		++frames;
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::cout << "Replayed " << messages.size() << " messages in " << frames << " frames in " << elapsed.count() * 1000 << " ms ("
+		<< messages.size() / elapsed.count() << " messages/s, " << frames / elapsed.count() << " frames/s)\n";
+	print_hashes(board, headless);
+
+	if (!others.empty()) {
+		const std::uint64_t expected = pixel_hash(board.pixels());
+		bool same = true;
+		for (const auto& other : others) {
+			for (const proto::message& message : messages) {
+				apply(*other, message);
+			}
+			other->draw_pending();
+			const std::uint64_t hash = pixel_hash(other->pixels());
+			std::cout << "Canvas hash with " << stroke_rasterizer::name(other->kernel()) << ": " << std::hex << hash << std::dec << "\n";
+			same = same && hash == expected;
+		}
+		std::cout << (same ? "All stroke kernels drew the same pixels." : "Stroke kernels drew different pixels!") << std::endl;
+		if (!same) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+struct options {
+	// Render into memory instead of a window, with no display or GPU.
+	bool headless = false;
+	// Replay this file instead of connecting to the server.
+	const char* replay = nullptr;
+	// Replay with every stroke kernel and check they agree.
+	bool compare_kernels = false;
+	// Draw strokes with this kernel. Without a window, or when replaying,
+	// the default is scalar, so hashes compare across CPUs; otherwise it
+	// is the fastest this CPU supports.
+	std::optional<stroke_rasterizer::kernel> kernel;
+	// Frames are drawn only when something changed, and at most this often.
+	int max_fps = 60;
+	// Leave thread placement and priorities to the OS, to compare the
+	// latencies in the frame report against the default layout.
+	bool plain_threads = false;
+	// Measure the outgoing queue against a locked one and exit.
+	bool bench_queue = false;
+	// Measure how snapshot encoding scales across pool workers and exit.
+	bool bench_pool = false;
+	// Join this many bot players to the server instead of opening a window.
+	int bots = 0;
+};
+
+static constexpr const char* usage = "Usage: skribbl-client [--headless] [--replay messages.ndjson [--compare-kernels]] [--kernel scalar|sse2|avx2] [--max-fps 60] [--plain-threads] [--bench-queue] [--bench-pool] [--bots 3]";
+
+std::optional<options> parse_options(int argc, char* argv[])
+{
+	options result;
+	for (int i = 1; i < argc; ++i) {
+		std::string_view argument = argv[i];
+		if (argument == "--headless") {
+			result.headless = true;
+		}
+		else if (argument == "--replay" && i + 1 < argc) {
+			result.replay = argv[++i];
+		}
+		else if (argument == "--compare-kernels") {
+			result.compare_kernels = true;
+		}
+		else if (argument == "--kernel" && i + 1 < argc) {
+			std::string_view name = argv[++i];
+			for (auto kernel : { stroke_rasterizer::kernel::scalar, stroke_rasterizer::kernel::sse2, stroke_rasterizer::kernel::avx2 }) {
+				if (name == stroke_rasterizer::name(kernel)) {
+					result.kernel = kernel;
+				}
+			}
+			if (!result.kernel) {
+				return std::nullopt;
+			}
+		}
+		else if (argument == "--plain-threads") {
+			result.plain_threads = true;
+		}
+		else if (argument == "--bench-queue") {
+			result.bench_queue = true;
+		}
+		else if (argument == "--bench-pool") {
+			result.bench_pool = true;
+		}
+		else if (argument == "--bots" && i + 1 < argc) {
+			result.bots = std::atoi(argv[++i]);
+			if (result.bots <= 0) {
+				return std::nullopt;
+			}
+		}
+		else if (argument == "--max-fps" && i + 1 < argc) {
+			result.max_fps = std::atoi(argv[++i]);
+			if (result.max_fps <= 0) {
+				return std::nullopt;
+			}
+		}
+		else {
+			return std::nullopt;
+		}
+	}
+	if (result.compare_kernels && !result.replay) {
+		return std::nullopt;
+	}
+	return result;
+}
+
+int main(int argc, char* argv[])
+try {
+	const std::optional<options> settings = parse_options(argc, argv);
+	if (!settings) {
+		std::cerr << usage << std::endl;
+		return 2;
+	}
+	if (settings->bench_queue) {
+		return bench_queue();
+	}
+	if (settings->bench_pool) {
+		return bench_pool();
+	}
+	if (settings->bots) {
+		return run_bots(settings->bots);
+	}
+	const stroke_rasterizer::kernel kernel = settings->kernel.value_or(settings->headless || settings->replay
+		? stroke_rasterizer::kernel::scalar : stroke_rasterizer::best_kernel());
+	if (!stroke_rasterizer::supported(kernel)) {
+		std::cerr << "This CPU cannot run the " << stroke_rasterizer::name(kernel) << " stroke kernel." << std::endl;
+		return 2;
+	}
+	if (settings->headless) {
+		headless_target::use_dummy_video();
+	}
+	sdl::subsystem subsystems{ sdl::subsystem::events | sdl::subsystem::video };
+	std::optional<sdl::window> window;
+	std::optional<sdl::renderer> window_renderer;
+	std::optional<headless_target> headless;
+	if (settings->headless) {
+		headless.emplace(canvas::default_size);
+	}
+	else {
+		window.emplace("skribbl", sdl::rect{ { sdl::window::centered, sdl::window::centered }, canvas::default_size }, sdl::window::shown);
+		window_renderer.emplace(*window, sdl::renderer::accelerated | sdl::renderer::target_texture);
+	}
+	sdl::renderer& renderer = headless ? headless->renderer() : *window_renderer;
+	canvas board{ renderer, canvas::default_size, kernel };
+	headless_target* headless_output = headless ? &*headless : nullptr;
+
+	if (settings->replay) {
+		return replay(settings->replay, renderer, board, headless_output, settings->compare_kernels);
+	}
+
+	// The receiver pushes this when messages arrive, so the loop below can
+	// sleep until there is something to do.
+	// Pool workers push the second one when they hand work back to this
+	// thread.
+	const sdl::event_type messages_arrived = sdl::register_events(2);
+	const auto main_jobs_posted = static_cast<sdl::event_type>(static_cast<sdl::u32>(messages_arrived) + 1);
+	const thread_layout threads = settings->plain_threads ? plain_thread_layout() : default_thread_layout();
+	configure_this_thread(threads.render);
+	start_client([messages_arrived] {
+		messages_received_at.store(frame_scheduler::clock::now());
+		return push_event(messages_arrived);
+	}, threads);
+	shared_pool().set_main_wake([main_jobs_posted] { return push_event(main_jobs_posted); });
+
+	frame_scheduler frames{ settings->max_fps };
+	std::thread{
+		read_commands,
+		[&board, headless_output] { print_hashes(board, headless_output); },
+		[&frames] { print_frame_report(frames.take_report()); }
+	}.detach();
+
+	std::vector<incoming_message> messages;
+	sdl::event event;
+	bool drawing = false;
+	frames.invalidate(frame_scheduler::window_changed);
+	for (bool running = true; running;) {
+		// Sleeps until an event arrives or the next frame is due, then takes
+		// every waiting event, so that they all go into one frame.
+		const std::optional<sdl::clock::duration> wait = frames.wait_time();
+		bool have_event = wait ? sdl::event_queue::await(event, *wait) : sdl::event_queue::await(event);
+		if (!have_event && !wait) {
+			throw sdl::error{};
+		}
+		for (; have_event; have_event = sdl::event_queue::poll(event)) {
+			if (event.type == sdl::event_type::quit) {
+				running = false;
+				break;
+			}
+			if (event.type == messages_arrived) {
+				handle_messages(messages, board);
+				frames.invalidate(frame_scheduler::canvas_changed, messages_received_at.load());
+			}
+			else if (event.type == main_jobs_posted) {
+				shared_pool().run_main();
+			}
+			else if (event.type == sdl::event_type::mouse_button_down && event.button.button == SDL_BUTTON_LEFT) {
+				drawing = true;
+				draw_stroke_point(board, to_canvas(renderer, board, event.button.x, event.button.y));
+				frames.invalidate(frame_scheduler::canvas_changed);
+			}
+			else if (event.type == sdl::event_type::mouse_button_down && event.button.button == SDL_BUTTON_RIGHT && !drawing) {
+				send_fill(board, to_canvas(renderer, board, event.button.x, event.button.y));
+				frames.invalidate(frame_scheduler::canvas_changed);
+			}
+			else if (event.type == sdl::event_type::mouse_motion && drawing) {
+				draw_stroke_point(board, to_canvas(renderer, board, event.motion.x, event.motion.y));
+				frames.invalidate(frame_scheduler::canvas_changed);
+			}
+			else if (event.type == sdl::event_type::mouse_button_up && event.button.button == SDL_BUTTON_LEFT && drawing) {
+				drawing = false;
+				draw_stroke_point(board, to_canvas(renderer, board, event.button.x, event.button.y));
+				end_stroke(board);
+				frames.invalidate(frame_scheduler::canvas_changed);
+			}
+			else if (event.type == sdl::event_type::key_down && (event.key.key.mod & (sdl::keymod_lctrl | sdl::keymod_rctrl))) {
+				// Ctrl+Z undoes, Ctrl+Y or Ctrl+Shift+Z redoes.
+				const sdl::keycode key = event.key.key.sym;
+				const bool shift = event.key.key.mod & (sdl::keymod_lshift | sdl::keymod_rshift);
+				const bool undo = key == sdl::keycode::z && !shift;
+				const bool redo = key == sdl::keycode::y || (key == sdl::keycode::z && shift);
+				if (undo || redo) {
+					if (drawing) {
+						drawing = false;
+						end_stroke(board);
+					}
+					if (undo && board.can_undo()) {
+						send_history_step<proto::undo_message>(board);
+					}
+					else if (redo && board.can_redo()) {
+						send_history_step<proto::redo_message>(board);
+					}
+					frames.invalidate(frame_scheduler::canvas_changed);
+				}
+			}
+			else if (event.type == sdl::event_type::render_targets_reset) {
+				board.restore();
+				frames.invalidate(frame_scheduler::window_changed);
+			}
+			else if (event.type == sdl::event_type::window) {
+				auto type = static_cast<sdl::window_event_type>(event.window.event);
+				if (type == sdl::window_event_type::exposed || type == sdl::window_event_type::size_changed) {
+					frames.invalidate(frame_scheduler::window_changed);
+				}
+			}
+		}
+
+		if (running && frames.frame_due()) {
+			frames.begin_frame();
+			draw_frame(renderer, board);
+			frames.end_frame();
+		}
+	}
+
+	// Gives messages typed just before quitting a moment to go out.
+	if (!stop_client(client::clock::now() + shutdown_drain_time)) {
+		std::cerr << "Some messages were not sent." << std::endl;
 	}
 
 	return 0;
@@ -0,0 +1,217 @@
+#include "Canvas.h"
+
+#include <algorithm>
+
+static constexpr sdl::color background{ 255, 255, 255, 255 };
+
+static bool same(const stroke_point& a, const stroke_point& b)
+{
+	return a.x == b.x && a.y == b.y;
+}
+
+static bool same(const sdl::color& a, const sdl::color& b)
+{
+	return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+canvas::canvas(sdl::renderer& renderer, sdl::size size, stroke_rasterizer::kernel kernel)
+	: _renderer(renderer)
+	, _size(size)
+	, _texture(renderer, sdl::pixel_format_type::argb8888, sdl::texture_access::streaming, size)
+	, _pixels(size, background)
+	, _rasterizer(kernel)
+{
+	// The canvas is opaque; alpha only matters while drawing into it.
+	_texture.set_blend_mode(sdl::blend_mode::none);
+	_checkpoints.push_back({ 0, _pixels });
+}
+
+void canvas::apply(const proto::line_message& line)
+{
+	++_sequence;
+	const stroke_point clamped = clamp_stroke_point({ static_cast<float>(line.x), static_cast<float>(line.y) }, _size);
+	sdl::point point{ static_cast<int>(clamped.x), static_cast<int>(clamped.y) };
+	sdl::color color{ static_cast<sdl::u8>(line.r), static_cast<sdl::u8>(line.g), static_cast<sdl::u8>(line.b), static_cast<sdl::u8>(line.a) };
+	if (!_pen) {
+		begin_stroke();
+	}
+	// The first point of a stroke is a segment of its own, so a click
+	// leaves a dot.
+	sdl::point from = _pen.value_or(point);
+	_segments.push_back({ { static_cast<float>(from.x), static_cast<float>(from.y) }, { static_cast<float>(point.x), static_cast<float>(point.y) }, color });
+	_pen = point;
+}
+
+void canvas::apply(const proto::end_line_message&)
+{
+	++_sequence;
+	end_stroke();
+}
+
+void canvas::apply(const proto::fill_message& fill)
+{
+	++_sequence;
+	end_stroke();
+	begin_stroke();
+	segment s;
+	s.from = s.to = clamp_stroke_point({ static_cast<float>(fill.x), static_cast<float>(fill.y) }, _size);
+	s.color = { static_cast<sdl::u8>(fill.r), static_cast<sdl::u8>(fill.g), static_cast<sdl::u8>(fill.b), static_cast<sdl::u8>(fill.a) };
+	s.fill = true;
+	s.tolerance = static_cast<std::uint8_t>(std::clamp(fill.tolerance, 0, 255));
+	_segments.push_back(s);
+	finish_stroke();
+}
+
+void canvas::apply(const proto::undo_message&)
+{
+	++_sequence;
+	end_stroke();
+	if (!can_undo()) {
+		return;
+	}
+	--_visible;
+	auto nearest = _checkpoints.rbegin();
+	while (nearest->strokes > _visible) {
+		++nearest;
+	}
+	_pixels.restore(nearest->pixels);
+	_drawn = _strokes[nearest->strokes];
+	_last.reset();
+	draw_pending();
+}
+
+void canvas::apply(const proto::redo_message&)
+{
+	++_sequence;
+	if (!_pen && can_redo()) {
+		++_visible;
+	}
+}
+
+void canvas::clear()
+{
+	_sequence = 0;
+	_segments.clear();
+	_strokes.clear();
+	_visible = 0;
+	_drawn = 0;
+	_last.reset();
+	_pen.reset();
+	_pixels.clear();
+	_checkpoints.clear();
+	_checkpoints.push_back({ 0, _pixels });
+}
+
+canvas_snapshot canvas::snapshot() const
+{
+	canvas_snapshot snapshot;
+	snapshot.size = _size;
+	auto nearest = _checkpoints.rbegin();
+	while (nearest->strokes > _visible) {
+		++nearest;
+	}
+	snapshot.base = nearest->strokes;
+	const tiled_canvas& pixels = nearest->pixels;
+	for (int row = 0; row < pixels.rows(); ++row) {
+		for (int column = 0; column < pixels.columns(); ++column) {
+			if (const std::uint32_t* tile = pixels.tile_pixels(column, row)) {
+				snapshot.tiles.push_back({ column, row, {} });
+				std::copy_n(tile, snapshot.tiles.back().pixels.size(), snapshot.tiles.back().pixels.begin());
+			}
+		}
+	}
+
+	const std::size_t first = _strokes.size() > snapshot.base ? _strokes[snapshot.base] : _segments.size();
+	for (std::size_t s = snapshot.base; s < _strokes.size(); ++s) {
+		snapshot.strokes.push_back(_strokes[s] - first);
+	}
+	snapshot.segments.assign(_segments.begin() + first, _segments.end());
+	snapshot.visible = _visible - snapshot.base;
+	snapshot.pen = _pen;
+	return snapshot;
+}
+
+bool canvas::load(const canvas_snapshot& snapshot, std::size_t sequence)
+{
+	if (snapshot.size.width != _size.width || snapshot.size.height != _size.height) {
+		return false;
+	}
+	clear();
+	for (const canvas_snapshot::tile& tile : snapshot.tiles) {
+		std::copy(tile.pixels.begin(), tile.pixels.end(), _pixels.writable_tile(tile.column, tile.row));
+		_pixels.mark_dirty(_pixels.tile_area(tile.column, tile.row));
+	}
+	_checkpoints.assign(1, { snapshot.base, _pixels });
+
+	_segments = snapshot.segments;
+	_strokes.assign(snapshot.base, 0);
+	for (std::size_t first : snapshot.strokes) {
+		_strokes.push_back(first);
+	}
+	_visible = snapshot.base + snapshot.visible;
+	_pen = snapshot.pen;
+	_sequence = sequence;
+	return true;
+}
+
+void canvas::restore()
+{
+	_pixels.mark_all_dirty();
+}
+
+void canvas::render(const sdl::rect* destination)
+{
+	draw_pending();
+	_pixels.upload(_texture);
+	_renderer.copy(_texture, nullptr, destination);
+}
+
+void canvas::begin_stroke()
+{
+	if (can_redo()) {
+		_segments.resize(_strokes[_visible]);
+		_strokes.resize(_visible);
+		while (_checkpoints.back().strokes > _visible) {
+			_checkpoints.pop_back();
+		}
+	}
+	_strokes.push_back(_segments.size());
+	++_visible;
+}
+
+void canvas::end_stroke()
+{
+	if (_pen) {
+		_pen.reset();
+		finish_stroke();
+	}
+}
+
+void canvas::finish_stroke()
+{
+	if (_visible % checkpoint_interval == 0 && _checkpoints.back().strokes < _visible) {
+		draw_pending();
+		_checkpoints.push_back({ _visible, _pixels });
+	}
+}
+
+std::size_t canvas::visible_end() const
+{
+	return _visible == _strokes.size() ? _segments.size() : _strokes[_visible];
+}
+
+void canvas::draw_pending()
+{
+	const std::size_t end = visible_end();
+	for (; _drawn < end; ++_drawn) {
+		const segment& s = _segments[_drawn];
+		if (s.fill) {
+			_filler.fill(_pixels, { static_cast<int>(s.from.x), static_cast<int>(s.from.y) }, s.color, s.tolerance);
+			_last.reset();
+			continue;
+		}
+		bool joined = _last && same(_last->to, s.from) && same(_last->color, s.color) && !same(s.from, s.to);
+		_pixels.draw_segment(_rasterizer, s.from, s.to, joined ? &_last->from : nullptr, brush_width, s.color);
+		_last = s;
+	}
+}
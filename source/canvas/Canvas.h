@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+#include <sdlw/sdlw.hpp>
+
+#include "../protocol/Protocol.h"
+#include "FloodFill.h"
+#include "Rasterizer.h"
+#include "Snapshot.h"
+#include "TiledCanvas.h"
+
+// The drawing of the current round. Strokes are rasterized into tiled
+// pixel storage as they arrive, and each frame only the tiles that changed
+// are uploaded to the texture that is shown, so the cost of a frame follows
+// the new input, not the length of the round.
+//
+// Every stroke is kept in a log, and every checkpoint_interval strokes the
+// pixels are snapshotted, which costs little as snapshots share tiles. Undo
+// goes back to the nearest snapshot and redraws at most that many strokes,
+// however long the round has been going.
+class canvas {
+public:
+	static constexpr sdl::size default_size{ 800, 600 };
+
+	// The protocol has no brush size, so every stroke is this wide.
+	static constexpr float brush_width = 3.0f;
+
+	static constexpr std::size_t checkpoint_interval = 32;
+
+	canvas(sdl::renderer& renderer, sdl::size size = default_size, stroke_rasterizer::kernel kernel = stroke_rasterizer::best_kernel());
+
+	// Extends the stroke being drawn to the message's point, or starts one.
+	// Starting one forgets the strokes that were undone.
+	void apply(const proto::line_message& line);
+
+	// Ends the stroke being drawn; the next line starts a new one.
+	void apply(const proto::end_line_message&);
+
+	// Fills the area around the message's point, as a stroke of its own.
+	// Ends the stroke being drawn first.
+	void apply(const proto::fill_message& fill);
+
+	// Takes back the last stroke, ending it first if it is being drawn.
+	void apply(const proto::undo_message&);
+
+	// Draws the last stroke taken back again.
+	void apply(const proto::redo_message&);
+
+	// Wipes the drawing and its history, e.g. for a new round.
+	void clear();
+
+	// The canvas for a player who joins now.
+	canvas_snapshot snapshot() const;
+
+	// Replaces the canvas with snapshot, taken when sequence drawing
+	// messages had been applied to the sender's canvas. Returns false if it
+	// is for a canvas of a different size. Strokes before the snapshot's
+	// base cannot be undone.
+	bool load(const canvas_snapshot& snapshot, std::size_t sequence);
+
+	// Draws what was added since the last call into the canvas, then copies
+	// the canvas to destination, or the whole window if null.
+	void render(const sdl::rect* destination = nullptr);
+
+	// Rasterizes the strokes and fills added since the last call without
+	// showing them, e.g. before reading pixels. A segment that continues
+	// the one before it in the same color is joined to it. render does
+	// this first.
+	void draw_pending();
+
+	// The renderer lost the canvas texture's contents, as Direct3D does when
+	// the device is reset. Uploads it whole on the next render.
+	void restore();
+
+	sdl::size size() const { return _size; }
+	const tiled_canvas& pixels() const { return _pixels; }
+	stroke_rasterizer::kernel kernel() const { return _rasterizer.active_kernel(); }
+
+	// Drawing messages applied this round, counting those in a loaded
+	// snapshot.
+	std::size_t sequence() const { return _sequence; }
+
+	bool can_undo() const { return _visible > _checkpoints.front().strokes; }
+	bool can_redo() const { return _visible != _strokes.size(); }
+
+private:
+	using segment = stroke_segment;
+
+	struct checkpoint {
+		// Strokes drawn in pixels.
+		std::size_t strokes;
+		tiled_canvas pixels;
+	};
+
+	// Adds a stroke to the log, forgetting the strokes that were undone.
+	void begin_stroke();
+
+	// Ends the stroke being drawn, if any.
+	void end_stroke();
+
+	// Takes a checkpoint after the stroke just ended when one is due.
+	void finish_stroke();
+
+	// Index of the first segment not shown.
+	std::size_t visible_end() const;
+
+	sdl::renderer& _renderer;
+	sdl::size _size;
+	sdl::texture _texture;
+	tiled_canvas _pixels;
+	stroke_rasterizer _rasterizer;
+	flood_filler _filler;
+
+	// End of the stroke being drawn.
+	std::optional<sdl::point> _pen;
+
+	// The stroke log: every segment of the round, and where each stroke's
+	// segments start. The first _visible strokes are shown; the rest were
+	// undone and can be redone. Strokes before a loaded snapshot's base
+	// have no segments.
+	std::vector<segment> _segments;
+	std::vector<std::size_t> _strokes;
+	std::size_t _visible = 0;
+
+	// Segments before this are in _pixels.
+	std::size_t _drawn = 0;
+	// The last segment rasterized, to join the next one to.
+	std::optional<segment> _last;
+
+	std::size_t _sequence = 0;
+
+	// Snapshots after 0 strokes, or a loaded snapshot's base, and then after
+	// every multiple of checkpoint_interval strokes, oldest first.
+	std::vector<checkpoint> _checkpoints;
+};
@@ -0,0 +1,92 @@
+#include "DirtyRegion.h"
+
+#include <limits>
+
+// What one copy costs apart from its pixels, in pixels. Two rectangles are
+// merged when copying their union would cost no more than this extra.
+static constexpr long long copy_overhead = 1024;
+
+static long long area(const sdl::rect& r)
+{
+	return static_cast<long long>(r.size.width) * r.size.height;
+}
+
+// Pixels copied needlessly by copying the union of a and b instead of both.
+static long long merge_cost(const sdl::rect& a, const sdl::rect& b)
+{
+	return area(sdl::rect_union(a, b)) - area(a) - area(b);
+}
+
+dirty_region::dirty_region(sdl::rect bounds)
+	: _bounds(bounds)
+{
+	add_all();
+}
+
+void dirty_region::add(sdl::rect area)
+{
+	auto clipped = sdl::intersection(area, _bounds);
+	if (!clipped) {
+		return;
+	}
+	_rects.push_back(*clipped);
+	merge_into(_rects.size() - 1);
+
+	while (_rects.size() > max_rects) {
+		std::size_t best_a = 0;
+		std::size_t best_b = 1;
+		long long best_cost = std::numeric_limits<long long>::max();
+		for (std::size_t a = 0; a < _rects.size(); ++a) {
+			for (std::size_t b = a + 1; b < _rects.size(); ++b) {
+				long long cost = merge_cost(_rects[a], _rects[b]);
+				if (cost < best_cost) {
+					best_a = a;
+					best_b = b;
+					best_cost = cost;
+				}
+			}
+		}
+		_rects[best_a] = sdl::rect_union(_rects[best_a], _rects[best_b]);
+		_rects.erase(_rects.begin() + best_b);
+		merge_into(best_a);
+	}
+}
+
+void dirty_region::add_all()
+{
+	_rects.assign(1, _bounds);
+}
+
+void dirty_region::clear()
+{
+	_rects.clear();
+}
+
+std::vector<sdl::rect> dirty_region::take()
+{
+	std::vector<sdl::rect> rects;
+	rects.swap(_rects);
+	return rects;
+}
+
+void dirty_region::merge_into(std::size_t i)
+{
+	// A merge grows rectangle i, which can make it worth merging with
+	// others it was not before.
+	bool merged = true;
+	while (merged) {
+		merged = false;
+		for (std::size_t j = 0; j < _rects.size(); ++j) {
+			if (j == i || merge_cost(_rects[i], _rects[j]) > copy_overhead) {
+				continue;
+			}
+			_rects[i] = sdl::rect_union(_rects[i], _rects[j]);
+			_rects.erase(_rects.begin() + j);
+			if (j < i) {
+				--i;
+			}
+			merged = true;
+			break;
+		}
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <sdlw/sdlw.hpp>
+
+// The parts of an area that changed, kept as a few rectangles so they can be
+// copied with one call each. Rectangles that would cost about as much to
+// copy together as apart are merged, and past max_rects the closest pair is
+// merged regardless, so the set stays small however many strokes arrive.
+class dirty_region {
+public:
+	static constexpr std::size_t max_rects = 8;
+
+	// Everything outside bounds is ignored. A new region is all dirty.
+	explicit dirty_region(sdl::rect bounds);
+
+	void add(sdl::rect area);
+	void add_all();
+	void clear();
+
+	bool empty() const { return _rects.empty(); }
+	const std::vector<sdl::rect>& rects() const { return _rects; }
+
+	// The dirty rectangles, leaving the region clean.
+	std::vector<sdl::rect> take();
+
+private:
+	// Merges rectangle i with any it should be merged with, repeatedly.
+	void merge_into(std::size_t i);
+
+	sdl::rect _bounds;
+	std::vector<sdl::rect> _rects;
+};
@@ -0,0 +1,262 @@
+#include "FloodFill.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FLOOD_FILL_X86
+#include <immintrin.h>
+#endif
+
+// GCC and Clang only emit AVX2 in functions marked for it; MSVC always does.
+#if defined(FLOOD_FILL_X86) && (defined(__GNUC__) || defined(__clang__))
+#define FLOOD_FILL_AVX2 __attribute__((target("avx2")))
+#else
+#define FLOOD_FILL_AVX2
+#endif
+
+static bool matches(std::uint32_t pixel, std::uint32_t seed, std::uint8_t tolerance)
+{
+	for (int shift = 0; shift < 32; shift += 8) {
+		int p = (pixel >> shift) & 0xff;
+		int s = (seed >> shift) & 0xff;
+		if (std::abs(p - s) > tolerance) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void match_scalar(const std::uint32_t* pixels, int count, std::uint32_t seed, std::uint8_t tolerance, std::uint8_t* out)
+{
+	for (int i = 0; i < count; ++i) {
+		out[i] = matches(pixels[i], seed, tolerance);
+	}
+}
+
+#ifdef FLOOD_FILL_X86
+
+// A pixel matches when, in every byte, the saturated difference either way
+// minus the tolerance is zero.
+static void match_sse2(const std::uint32_t* pixels, int count, std::uint32_t seed, std::uint8_t tolerance, std::uint8_t* out)
+{
+	const __m128i s = _mm_set1_epi32(static_cast<int>(seed));
+	const __m128i t = _mm_set1_epi8(static_cast<char>(tolerance));
+	const __m128i zero = _mm_setzero_si128();
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i));
+		__m128i difference = _mm_or_si128(_mm_subs_epu8(p, s), _mm_subs_epu8(s, p));
+		__m128i equal = _mm_cmpeq_epi32(_mm_subs_epu8(difference, t), zero);
+		__m128i bytes = _mm_packs_epi16(_mm_packs_epi32(equal, zero), zero);
+		auto flags = static_cast<std::uint32_t>(_mm_cvtsi128_si32(bytes)) & 0x01010101;
+		std::memcpy(out + i, &flags, sizeof(flags));
+	}
+	match_scalar(pixels + i, count - i, seed, tolerance, out + i);
+}
+
+// Byte i of entry m is 1 if bit i of m is set.
+static const std::array<std::uint64_t, 256> expand_bits = [] {
+	std::array<std::uint64_t, 256> table{};
+	for (int m = 0; m < 256; ++m) {
+		for (int bit = 0; bit < 8; ++bit) {
+			if (m & (1 << bit)) {
+				table[m] |= std::uint64_t{ 1 } << (bit * 8);
+			}
+		}
+	}
+	return table;
+}();
+
+FLOOD_FILL_AVX2 static void match_avx2(const std::uint32_t* pixels, int count, std::uint32_t seed, std::uint8_t tolerance, std::uint8_t* out)
+{
+	const __m256i s = _mm256_set1_epi32(static_cast<int>(seed));
+	const __m256i t = _mm256_set1_epi8(static_cast<char>(tolerance));
+	const __m256i zero = _mm256_setzero_si256();
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pixels + i));
+		__m256i difference = _mm256_or_si256(_mm256_subs_epu8(p, s), _mm256_subs_epu8(s, p));
+		__m256i equal = _mm256_cmpeq_epi32(_mm256_subs_epu8(difference, t), zero);
+		std::uint64_t flags = expand_bits[_mm256_movemask_ps(_mm256_castsi256_ps(equal))];
+		std::memcpy(out + i, &flags, sizeof(flags));
+	}
+	// Not the SSE2 kernel: legacy SSE code right after AVX code stalls.
+	match_scalar(pixels + i, count - i, seed, tolerance, out + i);
+}
+
+#endif
+
+// The first nonzero flag in [from, to), or to. Skips 8 flags at a time, as
+// the rows next to a span are mostly already filled.
+static int find_fillable(const std::uint8_t* flags, int from, int to)
+{
+	while (from + 8 <= to) {
+		std::uint64_t word;
+		std::memcpy(&word, flags + from, sizeof(word));
+		if (word != 0) {
+			break;
+		}
+		from += 8;
+	}
+	while (from < to && !flags[from]) {
+		++from;
+	}
+	return from;
+}
+
+// The first zero flag in [from, to), or to.
+static int find_filled(const std::uint8_t* flags, int from, int to)
+{
+	auto stop = static_cast<const std::uint8_t*>(std::memchr(flags + from, 0, to - from));
+	return stop ? static_cast<int>(stop - flags) : to;
+}
+
+static std::uint32_t blend(std::uint32_t destination, std::uint32_t source, int w)
+{
+	std::uint32_t result = 0;
+	for (int shift = 0; shift < 32; shift += 8) {
+		std::uint32_t d = (destination >> shift) & 0xff;
+		std::uint32_t s = (source >> shift) & 0xff;
+		result |= ((d * (256 - w) + s * w) >> 8) << shift;
+	}
+	return result;
+}
+
+flood_filler::kernel flood_filler::best_kernel()
+{
+#ifdef FLOOD_FILL_X86
+	if (sdl::has_avx2()) {
+		return kernel::avx2;
+	}
+	if (sdl::has_sse2()) {
+		return kernel::sse2;
+	}
+#endif
+	return kernel::scalar;
+}
+
+flood_filler::flood_filler(kernel k)
+	: _kernel(k)
+	, _match(match_scalar)
+{
+#ifdef FLOOD_FILL_X86
+	if (k == kernel::sse2) {
+		_match = match_sse2;
+	}
+	else if (k == kernel::avx2) {
+		_match = match_avx2;
+	}
+#else
+	if (k != kernel::scalar) {
+		throw std::invalid_argument{ "SIMD fill kernels need an x86 CPU." };
+	}
+#endif
+}
+
+std::size_t flood_filler::fill(tiled_canvas& canvas, sdl::point seed, sdl::color color, std::uint8_t tolerance) const
+{
+	constexpr int tile_size = tiled_canvas::tile_size;
+	const int width = canvas.size().width;
+	const int height = canvas.size().height;
+	if (seed.x < 0 || seed.y < 0 || seed.x >= width || seed.y >= height) {
+		return 0;
+	}
+
+	auto pixel_at = [&](int x, int y) {
+		const std::uint32_t* tile = canvas.tile_pixels(x / tile_size, y / tile_size);
+		return tile ? tile[(y % tile_size) * tile_size + x % tile_size] : canvas.background();
+	};
+	const std::uint32_t target = pixel_at(seed.x, seed.y);
+	const std::uint8_t background_matches = matches(canvas.background(), target, tolerance);
+
+	// Rows are only compared once the fill reaches them, and before any of
+	// their pixels change. Comparing writes the whole row of the mask.
+	const std::size_t mask_size = static_cast<std::size_t>(width) * height;
+	if (_fillable.size() != mask_size || _compared.size() != static_cast<std::size_t>(height) || ++_fills == 0) {
+		_fillable.resize(mask_size);
+		_compared.assign(height, 0);
+		_fills = 1;
+	}
+	auto row = [&](int y) {
+		std::uint8_t* flags = _fillable.data() + static_cast<std::size_t>(y) * width;
+		if (_compared[y] != _fills) {
+			_compared[y] = _fills;
+			for (int column = 0; column * tile_size < width; ++column) {
+				int count = std::min(tile_size, width - column * tile_size);
+				if (const std::uint32_t* tile = canvas.tile_pixels(column, y / tile_size)) {
+					_match(tile + (y % tile_size) * tile_size, count, target, tolerance, flags + column * tile_size);
+				}
+				else {
+					std::memset(flags + column * tile_size, background_matches, count);
+				}
+			}
+		}
+		return flags;
+	};
+
+	const std::uint32_t source = tiled_canvas::pixel(color);
+	const int w = color.a + (color.a >> 7);
+	auto paint = [&](int y, int left, int right) {
+		for (int x = left; x < right;) {
+			int column = x / tile_size;
+			int end = std::min(right, (column + 1) * tile_size);
+			std::uint32_t* pixels = canvas.writable_tile(column, y / tile_size) + (y % tile_size) * tile_size - column * tile_size;
+			if (w == 256) {
+				std::fill(pixels + x, pixels + end, source);
+			}
+			else {
+				for (int i = x; i < end; ++i) {
+					pixels[i] = blend(pixels[i], source, w);
+				}
+			}
+			x = end;
+		}
+	};
+
+	std::size_t filled = 0;
+	int top = seed.y, bottom = seed.y, left_most = seed.x, right_most = seed.x;
+	std::vector<sdl::point> pending{ seed };
+	while (!pending.empty()) {
+		sdl::point p = pending.back();
+		pending.pop_back();
+		std::uint8_t* flags = row(p.y);
+		if (!flags[p.x]) {
+			continue;
+		}
+
+		int left = p.x;
+		while (left > 0 && flags[left - 1]) {
+			--left;
+		}
+		int right = find_filled(flags, p.x, width);
+		std::memset(flags + left, 0, right - left);
+		paint(p.y, left, right);
+		filled += right - left;
+		top = std::min(top, p.y);
+		bottom = std::max(bottom, p.y);
+		left_most = std::min(left_most, left);
+		right_most = std::max(right_most, right - 1);
+
+		// One seed for each run of fillable pixels next to the span.
+		for (int y : { p.y - 1, p.y + 1 }) {
+			if (y < 0 || y >= height) {
+				continue;
+			}
+			const std::uint8_t* next = row(y);
+			for (int x = find_fillable(next, left, right); x < right; x = find_fillable(next, x, right)) {
+				pending.push_back({ x, y });
+				x = find_filled(next, x, right);
+			}
+		}
+	}
+
+	if (filled != 0) {
+		canvas.mark_dirty({ { left_most, top }, { right_most - left_most + 1, bottom - top + 1 } });
+	}
+	return filled;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <sdlw/sdlw.hpp>
+
+#include "TiledCanvas.h"
+
+// Paint bucket fill on a tiled canvas.
+//
+// Pixels are compared with the seed a row at a time by a SIMD kernel, and
+// only in rows the fill reaches. The fill then walks spans of matching
+// pixels a scanline at a time instead of pixel by pixel. The result only
+// depends on the canvas and the arguments, whichever kernel compares, so a
+// fill keeps canvases equal as long as the strokes under it drew the same
+// pixels; --replay --compare-kernels checks both.
+//
+// The mask of pixels still to fill is kept between fills, so fill is not
+// safe to call from more than one thread at a time.
+class flood_filler {
+public:
+	enum class kernel { scalar, sse2, avx2 };
+
+	// The fastest kernel this CPU supports.
+	static kernel best_kernel();
+
+	explicit flood_filler(kernel k = best_kernel());
+
+	kernel active_kernel() const { return _kernel; }
+
+	// Blends color over every pixel connected to seed, left, right, up or
+	// down, through pixels whose channels each differ from the seed pixel's
+	// by at most tolerance. Returns how many pixels were filled.
+	std::size_t fill(tiled_canvas& canvas, sdl::point seed, sdl::color color, std::uint8_t tolerance) const;
+
+	// Sets matches[i] to 1 if pixels[i] is within tolerance of seed, else 0.
+	using match_kernel = void (*)(const std::uint32_t* pixels, int count, std::uint32_t seed, std::uint8_t tolerance, std::uint8_t* matches);
+
+private:
+	kernel _kernel;
+	match_kernel _match;
+
+	// 1 where a pixel still has to be filled, a row of the canvas at a
+	// time. Only rows compared during the current fill hold anything
+	// meaningful, so nothing has to be cleared between fills.
+	mutable std::vector<std::uint8_t> _fillable;
+	// The fill that last compared each row, counting from 1.
+	mutable std::vector<std::uint32_t> _compared;
+	mutable std::uint32_t _fills = 0;
+};
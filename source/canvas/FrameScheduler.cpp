@@ -0,0 +1,143 @@
+#include "FrameScheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+static std::size_t latency_bucket(frame_scheduler::clock::duration latency, std::size_t buckets)
+{
+	const double microseconds = std::chrono::duration<double, std::micro>(latency).count();
+	if (microseconds < 1) {
+		return 0;
+	}
+	return std::min(static_cast<std::size_t>(std::log2(microseconds) * 8) + 1, buckets - 1);
+}
+
+static frame_scheduler::clock::duration bucket_end(std::size_t bucket)
+{
+	return std::chrono::duration_cast<frame_scheduler::clock::duration>(std::chrono::duration<double, std::micro>{ std::exp2(bucket / 8.0) });
+}
+
+frame_scheduler::frame_scheduler(int max_fps)
+	: _interval(std::chrono::duration_cast<clock::duration>(std::chrono::seconds{ 1 }) / std::max(max_fps, 1))
+	, _period_start(clock::now())
+{}
+
+void frame_scheduler::invalidate(reason why, clock::time_point since)
+{
+	_dirty |= why;
+	++_requests;
+	if (why != animation_running && (!_changed || since < *_changed)) {
+		_changed = since;
+	}
+}
+
+void frame_scheduler::start_animation()
+{
+	++_animations;
+	invalidate(animation_running);
+}
+
+void frame_scheduler::stop_animation()
+{
+	_animations = std::max(_animations - 1, 0);
+}
+
+std::optional<sdl::clock::duration> frame_scheduler::wait_time() const
+{
+	if (_dirty == 0) {
+		return std::nullopt;
+	}
+	if (!_last_frame) {
+		return sdl::clock::duration{ 0 };
+	}
+	clock::time_point next = *_last_frame + _interval;
+	clock::time_point now = clock::now();
+	if (next <= now) {
+		return sdl::clock::duration{ 0 };
+	}
+	// Rounded up, so the loop does not wake just before the frame is due.
+	return std::chrono::ceil<sdl::clock::duration>(next - now);
+}
+
+bool frame_scheduler::frame_due() const
+{
+	return _dirty != 0 && (!_last_frame || clock::now() >= *_last_frame + _interval);
+}
+
+void frame_scheduler::begin_frame()
+{
+	_frame_start = clock::now();
+	_last_frame = _frame_start;
+	if (_requests > 1) {
+		_coalesced += _requests - 1;
+	}
+	_requests = 0;
+	_dirty = 0;
+}
+
+void frame_scheduler::end_frame()
+{
+	clock::time_point now = clock::now();
+	clock::duration took = now - _frame_start;
+	if (_changed) {
+		const clock::duration latency = now - *_changed;
+		++_latencies[latency_bucket(latency, latency_buckets)];
+		++_latency_count;
+		_latency_worst = std::max(_latency_worst, latency);
+		_changed.reset();
+	}
+	++_frames;
+	_busy += took;
+	_worst = std::max(_worst, took);
+	if (took > _interval) {
+		++_over_budget;
+	}
+	if (_animations != 0) {
+		invalidate(animation_running);
+	}
+}
+
+frame_scheduler::report frame_scheduler::take_report()
+{
+	clock::time_point now = clock::now();
+	report r;
+	r.frames = _frames;
+	r.coalesced = _coalesced;
+	r.period = now - _period_start;
+	r.budget = _interval;
+	r.average = _frames != 0 ? _busy / _frames : clock::duration{};
+	r.worst = _worst;
+	r.over_budget = _over_budget;
+	r.busy = r.period.count() != 0 ? static_cast<double>(_busy.count()) / r.period.count() : 0;
+	r.latency_median = latency_percentile(0.5);
+	r.latency_99th = latency_percentile(0.99);
+	r.latency_worst = _latency_worst;
+
+	_period_start = now;
+	_frames = 0;
+	_coalesced = 0;
+	_busy = {};
+	_worst = {};
+	_over_budget = 0;
+	_latencies.fill(0);
+	_latency_count = 0;
+	_latency_worst = {};
+	return r;
+}
+
+frame_scheduler::clock::duration frame_scheduler::latency_percentile(double share) const
+{
+	if (_latency_count == 0) {
+		return {};
+	}
+	const auto rank = static_cast<std::size_t>((_latency_count - 1) * share);
+	std::size_t seen = 0;
+	for (std::size_t bucket = 0; bucket < latency_buckets; ++bucket) {
+		seen += _latencies[bucket];
+		if (seen > rank) {
+			return std::min(bucket_end(bucket), _latency_worst);
+		}
+	}
+	return _latency_worst;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include <sdlw/sdlw.hpp>
+
+// Decides when the main loop draws a frame: only when something on screen
+// changed or an animation is running, and no more often than max_fps.
+// In between, the loop sleeps on events for as long as wait_time says, so
+// an idle client uses no CPU.
+//
+// It also measures how long frames take against the budget of one frame
+// at max_fps, and how long changes wait until a frame shows them.
+class frame_scheduler {
+public:
+	using clock = sdl::high_resolution_clock;
+
+	// What a frame is needed for.
+	enum reason : unsigned {
+		canvas_changed = 1 << 0,
+		window_changed = 1 << 1,
+		ui_changed = 1 << 2,
+		animation_running = 1 << 3
+	};
+
+	struct report {
+		std::size_t frames = 0;
+		// Changes drawn together with another in one frame.
+		std::size_t coalesced = 0;
+		clock::duration period{};
+		clock::duration budget{};
+		clock::duration average{};
+		clock::duration worst{};
+		std::size_t over_budget = 0;
+		// Share of the period spent drawing, from 0 to 1.
+		double busy = 0;
+		// From a change to the end of the frame that shows it.
+		clock::duration latency_median{};
+		clock::duration latency_99th{};
+		clock::duration latency_worst{};
+	};
+
+	explicit frame_scheduler(int max_fps = 60);
+
+	// Asks for a frame showing a change made at since, e.g. when the
+	// messages behind it were received.
+	void invalidate(reason why, clock::time_point since = clock::now());
+
+	// While at least one animation runs, every frame asks for the next.
+	void start_animation();
+	void stop_animation();
+
+	// How long the loop may wait for events before the next frame is due:
+	// none for no limit, as no frame is wanted, or zero if one is due now.
+	std::optional<sdl::clock::duration> wait_time() const;
+
+	bool frame_due() const;
+
+	// Call around drawing each frame.
+	void begin_frame();
+	void end_frame();
+
+	// Frame times and latencies since the last report.
+	report take_report();
+
+private:
+	// Latency buckets, each 2^(1/8), about 9%, wider than the one before,
+	// from under a microsecond to over an hour.
+	static constexpr std::size_t latency_buckets = 256;
+
+	// The latency that share of those since the last report were under,
+	// rounded up to the end of its bucket.
+	clock::duration latency_percentile(double share) const;
+
+	clock::duration _interval;
+	unsigned _dirty = 0;
+	std::size_t _requests = 0;
+	int _animations = 0;
+	std::optional<clock::time_point> _last_frame;
+	clock::time_point _frame_start{};
+	// The oldest change the next frame shows.
+	std::optional<clock::time_point> _changed;
+
+	clock::time_point _period_start;
+	std::size_t _frames = 0;
+	std::size_t _coalesced = 0;
+	clock::duration _busy{};
+	clock::duration _worst{};
+	std::size_t _over_budget = 0;
+	// How many latencies fell in each bucket, so memory stays the same
+	// however long it is between reports.
+	std::array<std::uint32_t, latency_buckets> _latencies{};
+	std::size_t _latency_count = 0;
+	clock::duration _latency_worst{};
+};
@@ -0,0 +1,51 @@
+#include "Headless.h"
+
+#include <vector>
+
+static constexpr std::uint64_t fnv_offset_basis = 14695981039346656037ull;
+static constexpr std::uint64_t fnv_prime = 1099511628211ull;
+
+void headless_target::use_dummy_video()
+{
+	SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+}
+
+headless_target::headless_target(sdl::size size)
+	: _surface(size.width, size.height, 32, sdl::pixel_format_type::argb8888)
+	, _renderer(_surface)
+{}
+
+std::uint64_t headless_target::hash()
+{
+	const bool locking = _surface.must_lock();
+	if (locking) {
+		_surface.lock();
+	}
+	std::uint64_t result = pixel_hash(static_cast<const std::uint32_t*>(_surface.pixels()), _surface.size(), _surface.pitch());
+	if (locking) {
+		_surface.unlock();
+	}
+	return result;
+}
+
+std::uint64_t pixel_hash(const std::uint32_t* pixels, sdl::size size, int pitch)
+{
+	std::uint64_t hash = fnv_offset_basis;
+	for (int y = 0; y < size.height; ++y) {
+		auto row = reinterpret_cast<const std::uint32_t*>(reinterpret_cast<const unsigned char*>(pixels) + static_cast<std::ptrdiff_t>(y) * pitch);
+		for (int x = 0; x < size.width; ++x) {
+			for (int shift = 24; shift >= 0; shift -= 8) {
+				hash = (hash ^ (row[x] >> shift & 0xff)) * fnv_prime;
+			}
+		}
+	}
+	return hash;
+}
+
+std::uint64_t pixel_hash(const tiled_canvas& canvas)
+{
+	const sdl::size size = canvas.size();
+	std::vector<std::uint32_t> pixels(static_cast<std::size_t>(size.width) * size.height);
+	canvas.read({ { 0, 0 }, size }, sdl::pixel_format_type::argb8888, pixels.data(), size.width * static_cast<int>(sizeof(std::uint32_t)));
+	return pixel_hash(pixels.data(), size, size.width * static_cast<int>(sizeof(std::uint32_t)));
+}
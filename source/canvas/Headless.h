@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+
+#include <sdlw/sdlw.hpp>
+
+#include "TiledCanvas.h"
+
+// Rendering without a display or GPU, e.g. on build machines: SDL's dummy
+// video driver, and a software renderer drawing into a surface instead of
+// a window. What it renders can be checked by hash.
+class headless_target {
+public:
+	// Selects the dummy video driver unless SDL_VIDEODRIVER says otherwise.
+	// Call before starting the video subsystem.
+	static void use_dummy_video();
+
+	explicit headless_target(sdl::size size);
+
+	sdl::renderer& renderer() { return _renderer; }
+	const sdl::surface& surface() const { return _surface; }
+
+	// pixel_hash of everything rendered so far.
+	std::uint64_t hash();
+
+private:
+	sdl::surface _surface;
+	sdl::renderer _renderer;
+};
+
+// 64-bit FNV-1a hash of ARGB8888 pixels, row by row and each pixel as
+// alpha, red, green, blue, so equal pictures hash equal on every platform
+// whatever their pitch.
+std::uint64_t pixel_hash(const std::uint32_t* pixels, sdl::size size, int pitch);
+
+// pixel_hash of the canvas' pixels.
+std::uint64_t pixel_hash(const tiled_canvas& canvas);
@@ -0,0 +1,372 @@
+#include "Rasterizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RASTERIZER_X86
+#include <immintrin.h>
+#endif
+
+// GCC and Clang only emit AVX2 in functions marked for it; MSVC always does.
+#if defined(RASTERIZER_X86) && (defined(__GNUC__) || defined(__clang__))
+#define RASTERIZER_AVX2 __attribute__((target("avx2")))
+#else
+#define RASTERIZER_AVX2
+#endif
+
+using capsule = stroke_rasterizer::capsule;
+using row = stroke_rasterizer::row;
+
+static capsule make_capsule(stroke_point from, stroke_point to, float width)
+{
+	capsule c;
+	c.ax = from.x;
+	c.ay = from.y;
+	c.dx = to.x - from.x;
+	c.dy = to.y - from.y;
+	float length_squared = c.dx * c.dx + c.dy * c.dy;
+	c.inverse_length_squared = length_squared > 0 ? 1 / length_squared : 0;
+	c.reach = std::max(width, 0.0f) / 2 + 0.5f;
+	return c;
+}
+
+// How much of the pixel centered at x, y the capsule covers, from 0 to 1.
+static float coverage(const capsule& c, float x, float y)
+{
+	float ex = x - c.ax;
+	float ey = y - c.ay;
+	float t = std::clamp((ex * c.dx + ey * c.dy) * c.inverse_length_squared, 0.0f, 1.0f);
+	ex -= t * c.dx;
+	ey -= t * c.dy;
+	return std::clamp(c.reach - std::sqrt(ex * ex + ey * ey), 0.0f, 1.0f);
+}
+
+// Every client must draw the same pixels, whichever kernel its CPU runs,
+// so the SIMD kernels below do exactly the float operations of the scalar
+// one, in the same order, and round the same way. Check changes to any of
+// them with --replay --compare-kernels.
+
+// Keeps the division below finite when the previous segment fully covers
+// a pixel.
+static constexpr float min_remaining = 1e-6f;
+
+// Opacity to blend with, from 0 to 256. Over a pixel the previous segment
+// already blended at opacity p, blending at (s - p) / (1 - p) brings it to
+// max(s, p), as if covered once.
+static int weight(const row& r, float x)
+{
+	float opacity = r.alpha * coverage(*r.segment, x, r.y);
+	if (r.previous) {
+		float covered = r.alpha * coverage(*r.previous, x, r.y);
+		opacity = opacity > covered ? (opacity - covered) / std::max(1 - covered, min_remaining) : 0;
+	}
+	// Rounds halves up, as the kernels' truncating conversion of x + 0.5
+	// does.
+	float scaled = opacity * 256;
+	return static_cast<int>(scaled + 0.5f);
+}
+
+static std::uint32_t blend(std::uint32_t destination, std::uint32_t source, int w)
+{
+	std::uint32_t result = 0;
+	for (int shift = 0; shift < 32; shift += 8) {
+		std::uint32_t d = (destination >> shift) & 0xff;
+		std::uint32_t s = (source >> shift) & 0xff;
+		result |= ((d * (256 - w) + s * w) >> 8) << shift;
+	}
+	return result;
+}
+
+static void blend_row_scalar(const row& r)
+{
+	for (int i = 0; i < r.count; ++i) {
+		if (int w = weight(r, r.x + i)) {
+			r.pixels[i] = blend(r.pixels[i], r.color, w);
+		}
+	}
+}
+
+#ifdef RASTERIZER_X86
+
+static __m128 coverage_sse2(const capsule& c, __m128 x, float y)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1);
+	__m128 dx = _mm_set1_ps(c.dx);
+	__m128 dy = _mm_set1_ps(c.dy);
+	__m128 ex = _mm_sub_ps(x, _mm_set1_ps(c.ax));
+	__m128 ey = _mm_set1_ps(y - c.ay);
+	__m128 t = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(ex, dx), _mm_mul_ps(ey, dy)), _mm_set1_ps(c.inverse_length_squared));
+	t = _mm_min_ps(_mm_max_ps(t, zero), one);
+	ex = _mm_sub_ps(ex, _mm_mul_ps(t, dx));
+	ey = _mm_sub_ps(ey, _mm_mul_ps(t, dy));
+	__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey)));
+	return _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(c.reach), distance), zero), one);
+}
+
+static __m128i weight_sse2(const row& r, __m128 x)
+{
+	__m128 alpha = _mm_set1_ps(r.alpha);
+	__m128 opacity = _mm_mul_ps(alpha, coverage_sse2(*r.segment, x, r.y));
+	if (r.previous) {
+		__m128 covered = _mm_mul_ps(alpha, coverage_sse2(*r.previous, x, r.y));
+		__m128 remaining = _mm_max_ps(_mm_sub_ps(_mm_set1_ps(1), covered), _mm_set1_ps(min_remaining));
+		__m128 added = _mm_div_ps(_mm_sub_ps(opacity, covered), remaining);
+		opacity = _mm_and_ps(_mm_cmpgt_ps(opacity, covered), added);
+	}
+	return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(opacity, _mm_set1_ps(256)), _mm_set1_ps(0.5f)));
+}
+
+// Blends 8 channels, two pixels, widened to 16 bits.
+static __m128i blend_channels_sse2(__m128i destination, __m128i source, __m128i w)
+{
+	__m128i keep = _mm_sub_epi16(_mm_set1_epi16(256), w);
+	__m128i sum = _mm_add_epi16(_mm_mullo_epi16(destination, keep), _mm_mullo_epi16(source, w));
+	return _mm_srli_epi16(sum, 8);
+}
+
+static void blend_row_sse2(const row& r)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i source = _mm_unpacklo_epi8(_mm_set1_epi32(static_cast<int>(r.color)), zero);
+	const __m128 lanes = _mm_setr_ps(0, 1, 2, 3);
+	int i = 0;
+	for (; i + 4 <= r.count; i += 4) {
+		__m128i w = weight_sse2(r, _mm_add_ps(_mm_set1_ps(r.x + i), lanes));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(w, zero)) == 0xffff) {
+			continue;
+		}
+		// Spreads each pixel's weight over its four channels.
+		__m128i w16 = _mm_packs_epi32(w, w);
+		w16 = _mm_unpacklo_epi16(w16, w16);
+		__m128i w_low = _mm_unpacklo_epi32(w16, w16);
+		__m128i w_high = _mm_unpackhi_epi32(w16, w16);
+
+		auto pixels = reinterpret_cast<__m128i*>(r.pixels + i);
+		__m128i destination = _mm_loadu_si128(pixels);
+		__m128i low = blend_channels_sse2(_mm_unpacklo_epi8(destination, zero), source, w_low);
+		__m128i high = blend_channels_sse2(_mm_unpackhi_epi8(destination, zero), source, w_high);
+		_mm_storeu_si128(pixels, _mm_packus_epi16(low, high));
+	}
+	row rest = r;
+	rest.pixels += i;
+	rest.count -= i;
+	rest.x += i;
+	blend_row_scalar(rest);
+}
+
+RASTERIZER_AVX2 static __m256 coverage_avx2(const capsule& c, __m256 x, float y)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1);
+	__m256 dx = _mm256_set1_ps(c.dx);
+	__m256 dy = _mm256_set1_ps(c.dy);
+	__m256 ex = _mm256_sub_ps(x, _mm256_set1_ps(c.ax));
+	__m256 ey = _mm256_set1_ps(y - c.ay);
+	__m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(ex, dx), _mm256_mul_ps(ey, dy)), _mm256_set1_ps(c.inverse_length_squared));
+	t = _mm256_min_ps(_mm256_max_ps(t, zero), one);
+	ex = _mm256_sub_ps(ex, _mm256_mul_ps(t, dx));
+	ey = _mm256_sub_ps(ey, _mm256_mul_ps(t, dy));
+	__m256 distance = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(ex, ex), _mm256_mul_ps(ey, ey)));
+	return _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_set1_ps(c.reach), distance), zero), one);
+}
+
+RASTERIZER_AVX2 static __m256i weight_avx2(const row& r, __m256 x)
+{
+	__m256 alpha = _mm256_set1_ps(r.alpha);
+	__m256 opacity = _mm256_mul_ps(alpha, coverage_avx2(*r.segment, x, r.y));
+	if (r.previous) {
+		__m256 covered = _mm256_mul_ps(alpha, coverage_avx2(*r.previous, x, r.y));
+		__m256 remaining = _mm256_max_ps(_mm256_sub_ps(_mm256_set1_ps(1), covered), _mm256_set1_ps(min_remaining));
+		__m256 added = _mm256_div_ps(_mm256_sub_ps(opacity, covered), remaining);
+		opacity = _mm256_and_ps(_mm256_cmp_ps(opacity, covered, _CMP_GT_OQ), added);
+	}
+	return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(opacity, _mm256_set1_ps(256)), _mm256_set1_ps(0.5f)));
+}
+
+RASTERIZER_AVX2 static __m256i blend_channels_avx2(__m256i destination, __m256i source, __m256i w)
+{
+	__m256i keep = _mm256_sub_epi16(_mm256_set1_epi16(256), w);
+	__m256i sum = _mm256_add_epi16(_mm256_mullo_epi16(destination, keep), _mm256_mullo_epi16(source, w));
+	return _mm256_srli_epi16(sum, 8);
+}
+
+RASTERIZER_AVX2 static void blend_row_avx2(const row& r)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i source = _mm256_unpacklo_epi8(_mm256_set1_epi32(static_cast<int>(r.color)), zero);
+	const __m256 lanes = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+	int i = 0;
+	for (; i + 8 <= r.count; i += 8) {
+		__m256i w = weight_avx2(r, _mm256_add_ps(_mm256_set1_ps(r.x + i), lanes));
+		if (_mm256_testz_si256(w, w)) {
+			continue;
+		}
+		// Unpacking works within 128-bit lanes, so pixels 0, 1, 4 and 5 end
+		// up in low and 2, 3, 6 and 7 in high, and the weights follow suit.
+		__m256i w16 = _mm256_packs_epi32(w, w);
+		w16 = _mm256_unpacklo_epi16(w16, w16);
+		__m256i w_low = _mm256_unpacklo_epi32(w16, w16);
+		__m256i w_high = _mm256_unpackhi_epi32(w16, w16);
+
+		auto pixels = reinterpret_cast<__m256i*>(r.pixels + i);
+		__m256i destination = _mm256_loadu_si256(pixels);
+		__m256i low = blend_channels_avx2(_mm256_unpacklo_epi8(destination, zero), source, w_low);
+		__m256i high = blend_channels_avx2(_mm256_unpackhi_epi8(destination, zero), source, w_high);
+		_mm256_storeu_si256(pixels, _mm256_packus_epi16(low, high));
+	}
+	row rest = r;
+	rest.pixels += i;
+	rest.count -= i;
+	rest.x += i;
+	blend_row_sse2(rest);
+}
+
+#endif
+
+stroke_rasterizer::kernel stroke_rasterizer::best_kernel()
+{
+#ifdef RASTERIZER_X86
+	if (sdl::has_avx2()) {
+		return kernel::avx2;
+	}
+	if (sdl::has_sse2()) {
+		return kernel::sse2;
+	}
+#endif
+	return kernel::scalar;
+}
+
+bool stroke_rasterizer::supported(kernel k)
+{
+	switch (k) {
+#ifdef RASTERIZER_X86
+	case kernel::avx2:
+		return sdl::has_avx2();
+	case kernel::sse2:
+		return sdl::has_sse2();
+#endif
+	case kernel::scalar:
+		return true;
+	default:
+		return false;
+	}
+}
+
+const char* stroke_rasterizer::name(kernel k)
+{
+	switch (k) {
+	case kernel::avx2:
+		return "avx2";
+	case kernel::sse2:
+		return "sse2";
+	default:
+		return "scalar";
+	}
+}
+
+stroke_rasterizer::stroke_rasterizer(kernel k)
+	: _kernel(k)
+	, _blend_row(blend_row_scalar)
+{
+#ifdef RASTERIZER_X86
+	if (k == kernel::sse2) {
+		_blend_row = blend_row_sse2;
+	}
+	else if (k == kernel::avx2) {
+		_blend_row = blend_row_avx2;
+	}
+#else
+	if (k != kernel::scalar) {
+		throw std::invalid_argument{ "SIMD stroke kernels need an x86 CPU." };
+	}
+#endif
+}
+
+void stroke_rasterizer::draw(sdl::surface& target, const stroke_point* points, std::size_t count, float width, sdl::color color) const
+{
+	if (count == 1) {
+		draw_segment(target, points[0], points[0], nullptr, width, color);
+	}
+	for (std::size_t i = 1; i < count; ++i) {
+		draw_segment(target, points[i - 1], points[i], i > 1 ? &points[i - 2] : nullptr, width, color);
+	}
+}
+
+void stroke_rasterizer::draw_segment(sdl::surface& target, stroke_point from, stroke_point to, const stroke_point* previous, float width, sdl::color color) const
+{
+	if (target.format().bytes_per_pixel() != 4) {
+		throw std::invalid_argument{ "Strokes can only be drawn on 32-bit surfaces." };
+	}
+	raster_target pixels;
+	pixels.pixels = static_cast<std::uint32_t*>(target.pixels());
+	pixels.pitch = target.pitch();
+	pixels.origin = { 0, 0 };
+	pixels.clip = target.clip();
+	draw_segment(pixels, from, to, previous, width, target.format().map({ color.r, color.g, color.b, 255 }), color.a);
+}
+
+void stroke_rasterizer::draw_segment(const raster_target& target, stroke_point from, stroke_point to, const stroke_point* previous, float width, std::uint32_t color, std::uint8_t alpha) const
+{
+	if (alpha == 0) {
+		return;
+	}
+
+	const capsule segment = make_capsule(from, to, width);
+	capsule before;
+	if (previous) {
+		before = make_capsule(*previous, from, width);
+	}
+	const float reach = segment.reach;
+
+	const sdl::rect& clip = target.clip;
+	int left = std::max(clip.position.x, static_cast<int>(std::floor(std::min(from.x, to.x) - reach)));
+	int right = std::min(clip.position.x + clip.size.width, static_cast<int>(std::ceil(std::max(from.x, to.x) + reach)));
+	int top = std::max(clip.position.y, static_cast<int>(std::floor(std::min(from.y, to.y) - reach)));
+	int bottom = std::min(clip.position.y + clip.size.height, static_cast<int>(std::ceil(std::max(from.y, to.y) + reach)));
+	// Rows the previous segment can reach.
+	float before_top = previous ? std::min(previous->y, from.y) - reach : 0;
+	float before_bottom = previous ? std::max(previous->y, from.y) + reach : 0;
+
+	// Every pixel the capsule touches is within reach of the line through
+	// the segment, and no further than reach before its start or past its
+	// end along it. In each row, each of those is a span.
+	const float length = std::sqrt(segment.dx * segment.dx + segment.dy * segment.dy);
+	const bool steep = std::abs(segment.dy) > 1e-3f;
+	const bool wide = std::abs(segment.dx) > 1e-3f;
+	const float half_span = steep ? reach * length / std::abs(segment.dy) : 0;
+
+	auto base = reinterpret_cast<std::uint8_t*>(target.pixels);
+	row r;
+	r.segment = &segment;
+	r.color = color;
+	r.alpha = alpha / 255.0f;
+	for (int y = top; y < bottom; ++y) {
+		r.y = y + 0.5f;
+		int x0 = left;
+		int x1 = right;
+		if (steep) {
+			float center = segment.ax + (r.y - segment.ay) * segment.dx / segment.dy;
+			x0 = std::max(x0, static_cast<int>(std::floor(center - half_span)));
+			x1 = std::min(x1, static_cast<int>(std::ceil(center + half_span)));
+		}
+		if (wide) {
+			float offset = (r.y - segment.ay) * segment.dy;
+			float start = segment.ax + (-reach * length - offset) / segment.dx;
+			float end = segment.ax + ((length + reach) * length - offset) / segment.dx;
+			x0 = std::max(x0, static_cast<int>(std::floor(std::min(start, end))));
+			x1 = std::min(x1, static_cast<int>(std::ceil(std::max(start, end))));
+		}
+		if (x1 <= x0) {
+			continue;
+		}
+		r.pixels = reinterpret_cast<std::uint32_t*>(base + static_cast<std::ptrdiff_t>(y - target.origin.y) * target.pitch) + (x0 - target.origin.x);
+		r.count = x1 - x0;
+		r.x = x0 + 0.5f;
+		r.previous = previous && r.y >= before_top && r.y <= before_bottom ? &before : nullptr;
+		_blend_row(r);
+	}
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <sdlw/sdlw.hpp>
+
+struct stroke_point {
+	float x;
+	float y;
+};
+
+// 32-bit pixels to draw on. The pixel at x, y is in row y - origin.y,
+// column x - origin.x, and only pixels inside clip are drawn on.
+struct raster_target {
+	std::uint32_t* pixels;
+	// Bytes from one row to the next.
+	int pitch;
+	sdl::point origin;
+	sdl::rect clip;
+};
+
+// Draws anti-aliased brush strokes of any width, with round caps and joins,
+// into a 32-bit surface in software. It needs no renderer, so it also works
+// without a window or GPU.
+//
+// Each pixel is blended with the stroke color by how much of it the stroke
+// covers. Where a segment overlaps the one before it, the overlap is only
+// covered once, so translucent strokes stay even at their joints. Every
+// kernel draws exactly the same pixels.
+class stroke_rasterizer {
+public:
+	enum class kernel { scalar, sse2, avx2 };
+
+	// The fastest kernel this CPU supports.
+	static kernel best_kernel();
+
+	static bool supported(kernel k);
+	static const char* name(kernel k);
+
+	explicit stroke_rasterizer(kernel k = best_kernel());
+
+	kernel active_kernel() const { return _kernel; }
+
+	// Draws the polyline through count points, width pixels wide. A single
+	// point draws a dot. target must be 32 bits per pixel and locked if it
+	// must be; drawing is clipped to its clip rectangle.
+	void draw(sdl::surface& target, const stroke_point* points, std::size_t count, float width, sdl::color color) const;
+
+	// Draws the segment from from to to. previous is the start of the
+	// segment that ends at from, if any; pixels it covered are not covered
+	// again.
+	void draw_segment(sdl::surface& target, stroke_point from, stroke_point to, const stroke_point* previous, float width, sdl::color color) const;
+
+	// Like the above, with color already a pixel value in target's format
+	// and alpha its opacity.
+	void draw_segment(const raster_target& target, stroke_point from, stroke_point to, const stroke_point* previous, float width, std::uint32_t color, std::uint8_t alpha) const;
+
+	struct capsule {
+		float ax, ay;
+		float dx, dy;
+		float inverse_length_squared;
+		// Half the width, plus half a pixel of anti-aliasing.
+		float reach;
+	};
+
+	// A run of pixels in one row for a kernel to blend.
+	struct row {
+		std::uint32_t* pixels;
+		int count;
+		// Center of the first pixel.
+		float x;
+		float y;
+		const capsule* segment;
+		const capsule* previous;
+		std::uint32_t color;
+		float alpha;
+	};
+
+private:
+	using row_kernel = void (*)(const row&);
+
+	kernel _kernel;
+	row_kernel _blend_row;
+};
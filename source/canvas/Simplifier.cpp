@@ -0,0 +1,81 @@
+#include "Simplifier.h"
+
+#include <cmath>
+
+stroke_simplifier::stroke_simplifier(float tolerance)
+	: _tolerance(tolerance)
+{}
+
+void stroke_simplifier::add(sdl::point point, std::vector<sdl::point>& out)
+{
+	++_stats.points_in;
+	if (!_started) {
+		_started = true;
+		_anchor = point;
+		emit(point, out);
+		return;
+	}
+	// Staying on the last point sent adds nothing, but coming back to it
+	// after moving away must still be sent.
+	if (_held.empty() && point.x == _anchor.x && point.y == _anchor.y) {
+		return;
+	}
+	if (_held.size() >= max_held || !fits(point)) {
+		if (!_held.empty()) {
+			_anchor = _held.back();
+			_held.clear();
+			emit(_anchor, out);
+		}
+	}
+	_held.push_back(point);
+}
+
+void stroke_simplifier::finish(std::vector<sdl::point>& out)
+{
+	if (!_held.empty()) {
+		emit(_held.back(), out);
+	}
+	_held.clear();
+	_started = false;
+}
+
+bool stroke_simplifier::fits(sdl::point end) const
+{
+	float dx = static_cast<float>(end.x - _anchor.x);
+	float dy = static_cast<float>(end.y - _anchor.y);
+	float length = std::sqrt(dx * dx + dy * dy);
+	for (const sdl::point& p : _held) {
+		float px = static_cast<float>(p.x - _anchor.x);
+		float py = static_cast<float>(p.y - _anchor.y);
+		if (length == 0) {
+			// The stroke came back to _anchor; the segment is a point.
+			if (std::sqrt(px * px + py * py) > _tolerance) {
+				return false;
+			}
+			continue;
+		}
+		// Distance to the segment, not the line, so a stroke that doubles
+		// back on itself keeps its turning point.
+		float t = (px * dx + py * dy) / (length * length);
+		float distance;
+		if (t <= 0) {
+			distance = std::sqrt(px * px + py * py);
+		}
+		else if (t >= 1) {
+			distance = std::hypot(px - dx, py - dy);
+		}
+		else {
+			distance = std::abs(px * dy - py * dx) / length;
+		}
+		if (distance > _tolerance) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void stroke_simplifier::emit(sdl::point point, std::vector<sdl::point>& out)
+{
+	++_stats.points_out;
+	out.push_back(point);
+}
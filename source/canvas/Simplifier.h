@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <sdlw/sdlw.hpp>
+
+// Drops stroke points that add nothing visible, as input arrives. A point
+// is dropped while the line from the last kept point to the newest one
+// passes within tolerance pixels of every point dropped in between, so the
+// kept polyline never strays further than that from the input.
+class stroke_simplifier {
+public:
+	static constexpr float default_tolerance = 0.75f;
+
+	// Dropping stops after this many points in a row, so a long, straight,
+	// slow stroke still reaches others while it is drawn.
+	static constexpr std::size_t max_held = 32;
+
+	struct stats {
+		std::uint64_t points_in = 0;
+		std::uint64_t points_out = 0;
+	};
+
+	explicit stroke_simplifier(float tolerance = default_tolerance);
+
+	// Takes the next point of the stroke and appends the points to send to
+	// out, which are none, the held point before it or, at the start of a
+	// stroke, the point itself.
+	void add(sdl::point point, std::vector<sdl::point>& out);
+
+	// Ends the stroke, appending the last point to out if it was held.
+	void finish(std::vector<sdl::point>& out);
+
+	const stats& totals() const { return _stats; }
+
+private:
+	bool fits(sdl::point end) const;
+	void emit(sdl::point point, std::vector<sdl::point>& out);
+
+	float _tolerance;
+	bool _started = false;
+	sdl::point _anchor{};
+	// Input since _anchor, none of it sent yet.
+	std::vector<sdl::point> _held;
+	stats _stats;
+};
@@ -0,0 +1,462 @@
+#include "Snapshot.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#include "../protocol/Compression.h"
+#include "../protocol/Varint.h"
+
+// Layout of the data before compression, all numbers varints:
+//
+//   version width height base tile_count
+//   tile_count x (column row), then the pixels of every tile, row by row,
+//     as one stream of the pixel ops below
+//   stroke_count visible
+//   stroke_count x (segment_count * 2 + is_fill, segments...), each
+//     segment the zigzag deltas from the previous segment's end to its
+//     start and from its start to its end, then 4 color bytes, and for a
+//     fill its one segment is followed by the tolerance byte
+//   has_pen [pen_x pen_y as zigzag]
+//
+// The pixel ops are those of the QOI image format: a run of the previous
+// pixel, a pixel seen recently, a small or luma-based difference from the
+// previous pixel, or a whole pixel. Anti-aliased edges are mostly shades
+// between a stroke's color and what is under it, so they take a byte or
+// two per pixel where plain run-length encoding takes five.
+static constexpr std::uint32_t format_version = 3;
+static constexpr std::size_t tile_pixels = tiled_canvas::tile_size * tiled_canvas::tile_size;
+
+static const char base64_digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static std::string to_base64(const std::string& data)
+{
+	std::string out;
+	out.reserve((data.size() + 2) / 3 * 4);
+	std::size_t i = 0;
+	for (; i + 2 < data.size(); i += 3) {
+		std::uint32_t group = static_cast<unsigned char>(data[i]) << 16 | static_cast<unsigned char>(data[i + 1]) << 8 | static_cast<unsigned char>(data[i + 2]);
+		out += base64_digits[group >> 18];
+		out += base64_digits[group >> 12 & 63];
+		out += base64_digits[group >> 6 & 63];
+		out += base64_digits[group & 63];
+	}
+	if (i + 1 == data.size()) {
+		std::uint32_t group = static_cast<unsigned char>(data[i]) << 16;
+		out += base64_digits[group >> 18];
+		out += base64_digits[group >> 12 & 63];
+		out += "==";
+	}
+	else if (i + 2 == data.size()) {
+		std::uint32_t group = static_cast<unsigned char>(data[i]) << 16 | static_cast<unsigned char>(data[i + 1]) << 8;
+		out += base64_digits[group >> 18];
+		out += base64_digits[group >> 12 & 63];
+		out += base64_digits[group >> 6 & 63];
+		out += '=';
+	}
+	return out;
+}
+
+static bool from_base64(std::string_view text, std::string& out)
+{
+	if (text.size() % 4 != 0) {
+		return false;
+	}
+	std::array<signed char, 256> values;
+	values.fill(-1);
+	for (int i = 0; i < 64; ++i) {
+		values[static_cast<unsigned char>(base64_digits[i])] = static_cast<signed char>(i);
+	}
+	out.reserve(text.size() / 4 * 3);
+	for (std::size_t i = 0; i < text.size(); i += 4) {
+		std::uint32_t group = 0;
+		int padding = 0;
+		for (std::size_t j = 0; j < 4; ++j) {
+			char c = text[i + j];
+			if (c == '=' && i + 4 == text.size() && j >= 2) {
+				++padding;
+				group <<= 6;
+				continue;
+			}
+			int value = values[static_cast<unsigned char>(c)];
+			if (value < 0 || padding != 0) {
+				return false;
+			}
+			group = group << 6 | static_cast<std::uint32_t>(value);
+		}
+		out += static_cast<char>(group >> 16);
+		if (padding < 2) out += static_cast<char>(group >> 8 & 0xFF);
+		if (padding < 1) out += static_cast<char>(group & 0xFF);
+	}
+	return true;
+}
+
+namespace pixel_op {
+constexpr unsigned char index = 0x00;
+constexpr unsigned char diff = 0x40;
+constexpr unsigned char luma = 0x80;
+constexpr unsigned char run = 0xC0;
+constexpr unsigned char rgb = 0xFE;
+constexpr unsigned char rgba = 0xFF;
+constexpr unsigned char mask = 0xC0;
+constexpr int max_run = 62;
+} // namespace pixel_op
+
+struct rgba {
+	int r, g, b, a;
+};
+
+static rgba unpack(std::uint32_t pixel)
+{
+	return { static_cast<int>(pixel >> 16 & 0xFF), static_cast<int>(pixel >> 8 & 0xFF), static_cast<int>(pixel & 0xFF), static_cast<int>(pixel >> 24) };
+}
+
+static std::uint32_t pack(const rgba& c)
+{
+	return static_cast<std::uint32_t>(c.a) << 24 | static_cast<std::uint32_t>(c.r) << 16 | static_cast<std::uint32_t>(c.g) << 8 | static_cast<std::uint32_t>(c.b);
+}
+
+static std::size_t hash(const rgba& c)
+{
+	return static_cast<std::size_t>(c.r * 3 + c.g * 5 + c.b * 7 + c.a * 11) % 64;
+}
+
+// Wraps a channel difference into -128..127, as the channels are bytes.
+static int wrap(int difference)
+{
+	return static_cast<signed char>(static_cast<unsigned char>(difference & 0xFF));
+}
+
+// Encodes a stream of pixels; the state carries over from tile to tile.
+class pixel_encoder {
+	std::array<std::uint32_t, 64> _seen{};
+	std::uint32_t _previous = 0xFF000000;
+	int _run = 0;
+
+public:
+	void add(std::uint32_t pixel, std::string& out)
+	{
+		if (pixel == _previous) {
+			if (++_run == pixel_op::max_run) {
+				flush(out);
+			}
+			return;
+		}
+		flush(out);
+
+		rgba c = unpack(pixel);
+		std::size_t slot = hash(c);
+		if (_seen[slot] == pixel) {
+			out += static_cast<char>(pixel_op::index | slot);
+		}
+		else {
+			_seen[slot] = pixel;
+			rgba p = unpack(_previous);
+			if (c.a != p.a) {
+				out += static_cast<char>(pixel_op::rgba);
+				out += static_cast<char>(c.r);
+				out += static_cast<char>(c.g);
+				out += static_cast<char>(c.b);
+				out += static_cast<char>(c.a);
+			}
+			else {
+				int dr = wrap(c.r - p.r);
+				int dg = wrap(c.g - p.g);
+				int db = wrap(c.b - p.b);
+				if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+					out += static_cast<char>(pixel_op::diff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+				}
+				else if (dg >= -32 && dg <= 31 && dr - dg >= -8 && dr - dg <= 7 && db - dg >= -8 && db - dg <= 7) {
+					out += static_cast<char>(pixel_op::luma | (dg + 32));
+					out += static_cast<char>((dr - dg + 8) << 4 | (db - dg + 8));
+				}
+				else {
+					out += static_cast<char>(pixel_op::rgb);
+					out += static_cast<char>(c.r);
+					out += static_cast<char>(c.g);
+					out += static_cast<char>(c.b);
+				}
+			}
+		}
+		_previous = pixel;
+	}
+
+	void flush(std::string& out)
+	{
+		if (_run != 0) {
+			out += static_cast<char>(pixel_op::run | (_run - 1));
+			_run = 0;
+		}
+	}
+};
+
+class snapshot_reader {
+	const char* _position;
+	const char* _end;
+
+public:
+	explicit snapshot_reader(const std::string& data)
+		: _position{ data.data() }
+		, _end{ data.data() + data.size() }
+	{}
+
+	bool at_end() const
+	{
+		return _position == _end;
+	}
+
+	bool read_byte(unsigned char& out)
+	{
+		if (_position == _end) return false;
+		out = static_cast<unsigned char>(*_position++);
+		return true;
+	}
+
+	bool read_varint(std::uint32_t& out)
+	{
+		return proto::read_varint(_position, _end, out);
+	}
+
+	bool read_signed(int& out)
+	{
+		return proto::read_zigzag_varint(_position, _end, out);
+	}
+
+};
+
+// Decodes what pixel_encoder wrote.
+class pixel_decoder {
+	std::array<std::uint32_t, 64> _seen{};
+	std::uint32_t _previous = 0xFF000000;
+	int _run = 0;
+
+public:
+	bool next(snapshot_reader& reader, std::uint32_t& out)
+	{
+		if (_run != 0) {
+			--_run;
+			out = _previous;
+			return true;
+		}
+		unsigned char op;
+		if (!reader.read_byte(op)) return false;
+		rgba c = unpack(_previous);
+		if (op == pixel_op::rgb || op == pixel_op::rgba) {
+			unsigned char r, g, b, a = static_cast<unsigned char>(c.a);
+			if (!reader.read_byte(r) || !reader.read_byte(g) || !reader.read_byte(b)) return false;
+			if (op == pixel_op::rgba && !reader.read_byte(a)) return false;
+			c = { r, g, b, a };
+		}
+		else if ((op & pixel_op::mask) == pixel_op::index) {
+			out = _previous = _seen[op & 63];
+			return true;
+		}
+		else if ((op & pixel_op::mask) == pixel_op::diff) {
+			c.r = (c.r + (op >> 4 & 3) - 2) & 0xFF;
+			c.g = (c.g + (op >> 2 & 3) - 2) & 0xFF;
+			c.b = (c.b + (op & 3) - 2) & 0xFF;
+		}
+		else if ((op & pixel_op::mask) == pixel_op::luma) {
+			unsigned char second;
+			if (!reader.read_byte(second)) return false;
+			int dg = (op & 63) - 32;
+			c.r = (c.r + dg + (second >> 4) - 8) & 0xFF;
+			c.g = (c.g + dg) & 0xFF;
+			c.b = (c.b + dg + (second & 15) - 8) & 0xFF;
+		}
+		else {
+			_run = op & 63;
+			out = _previous;
+			return true;
+		}
+		_previous = pack(c);
+		_seen[hash(c)] = _previous;
+		out = _previous;
+		return true;
+	}
+};
+
+stroke_point clamp_stroke_point(stroke_point point, sdl::size size)
+{
+	return { std::clamp(point.x, -stroke_margin, size.width + stroke_margin), std::clamp(point.y, -stroke_margin, size.height + stroke_margin) };
+}
+
+// The longest a segment and its share of its stroke's header get.
+static constexpr std::size_t max_segment_size = 6 * proto::max_varint_size + 5;
+
+std::size_t max_snapshot_data(sdl::size size)
+{
+	const auto columns = static_cast<std::size_t>((size.width + tiled_canvas::tile_size - 1) / tiled_canvas::tile_size);
+	const auto rows = static_cast<std::size_t>((size.height + tiled_canvas::tile_size - 1) / tiled_canvas::tile_size);
+	const std::size_t header = 10 * proto::max_varint_size;
+	const std::size_t tiles = columns * rows * (2 * proto::max_varint_size + tile_pixels * 5);
+	return header + tiles + max_snapshot_segments * max_segment_size;
+}
+
+std::size_t max_snapshot_text(sdl::size size)
+{
+	// What no compression costs, then base64.
+	const std::size_t data = max_snapshot_data(size);
+	const std::size_t compressed = data + data / 255 + 16;
+	return (compressed + 2) / 3 * 4;
+}
+
+std::string encode_snapshot(const canvas_snapshot& snapshot)
+{
+	if (snapshot.segments.size() > max_snapshot_segments) {
+		return {};
+	}
+	std::string data;
+	proto::put_varint(format_version, data);
+	proto::put_varint(static_cast<std::uint32_t>(snapshot.size.width), data);
+	proto::put_varint(static_cast<std::uint32_t>(snapshot.size.height), data);
+	proto::put_varint(static_cast<std::uint32_t>(snapshot.base), data);
+
+	proto::put_varint(static_cast<std::uint32_t>(snapshot.tiles.size()), data);
+	for (const canvas_snapshot::tile& tile : snapshot.tiles) {
+		proto::put_varint(static_cast<std::uint32_t>(tile.column), data);
+		proto::put_varint(static_cast<std::uint32_t>(tile.row), data);
+	}
+	pixel_encoder pixels;
+	for (const canvas_snapshot::tile& tile : snapshot.tiles) {
+		for (std::uint32_t pixel : tile.pixels) {
+			pixels.add(pixel, data);
+		}
+	}
+	pixels.flush(data);
+
+	proto::put_varint(static_cast<std::uint32_t>(snapshot.strokes.size()), data);
+	proto::put_varint(static_cast<std::uint32_t>(snapshot.visible), data);
+	stroke_point end{ 0, 0 };
+	for (std::size_t s = 0; s < snapshot.strokes.size(); ++s) {
+		std::size_t first = snapshot.strokes[s];
+		std::size_t last = s + 1 < snapshot.strokes.size() ? snapshot.strokes[s + 1] : snapshot.segments.size();
+		const bool fill = first != last && snapshot.segments[first].fill;
+		proto::put_varint(static_cast<std::uint32_t>(last - first) << 1 | (fill ? 1 : 0), data);
+		for (std::size_t i = first; i < last; ++i) {
+			const stroke_segment& segment = snapshot.segments[i];
+			proto::put_zigzag_varint(static_cast<int>(segment.from.x - end.x), data);
+			proto::put_zigzag_varint(static_cast<int>(segment.from.y - end.y), data);
+			proto::put_zigzag_varint(static_cast<int>(segment.to.x - segment.from.x), data);
+			proto::put_zigzag_varint(static_cast<int>(segment.to.y - segment.from.y), data);
+			data += static_cast<char>(segment.color.r);
+			data += static_cast<char>(segment.color.g);
+			data += static_cast<char>(segment.color.b);
+			data += static_cast<char>(segment.color.a);
+			if (fill) {
+				data += static_cast<char>(segment.tolerance);
+			}
+			end = segment.to;
+		}
+	}
+
+	proto::put_varint(snapshot.pen ? 1 : 0, data);
+	if (snapshot.pen) {
+		proto::put_zigzag_varint(snapshot.pen->x, data);
+		proto::put_zigzag_varint(snapshot.pen->y, data);
+	}
+
+	std::string compressed;
+	proto::stream_compressor{}.compress(data.data(), data.size(), compressed);
+	return to_base64(compressed);
+}
+
+bool decode_snapshot(std::string_view text, sdl::size size, canvas_snapshot& out)
+{
+	if (text.size() > max_snapshot_text(size)) {
+		return false;
+	}
+	std::string compressed;
+	std::string data;
+	if (!from_base64(text, compressed) || !proto::stream_decompressor{}.decompress(compressed.data(), compressed.size(), data, max_snapshot_data(size))) {
+		return false;
+	}
+
+	snapshot_reader reader{ data };
+	std::uint32_t version, width, height, base, tile_count;
+	if (!reader.read_varint(version) || version != format_version
+		|| !reader.read_varint(width) || !reader.read_varint(height) || !reader.read_varint(base)
+		|| !reader.read_varint(tile_count) || static_cast<int>(width) != size.width || static_cast<int>(height) != size.height) {
+		return false;
+	}
+	out = canvas_snapshot{};
+	out.size = { static_cast<int>(width), static_cast<int>(height) };
+	out.base = base;
+	const std::uint32_t columns = (width + tiled_canvas::tile_size - 1) / tiled_canvas::tile_size;
+	const std::uint32_t rows = (height + tiled_canvas::tile_size - 1) / tiled_canvas::tile_size;
+	if (tile_count > columns * rows) {
+		return false;
+	}
+
+	out.tiles.resize(tile_count);
+	for (canvas_snapshot::tile& tile : out.tiles) {
+		std::uint32_t column, row;
+		if (!reader.read_varint(column) || !reader.read_varint(row) || column >= columns || row >= rows) {
+			return false;
+		}
+		tile.column = static_cast<int>(column);
+		tile.row = static_cast<int>(row);
+	}
+	pixel_decoder pixels;
+	for (canvas_snapshot::tile& tile : out.tiles) {
+		for (std::uint32_t& pixel : tile.pixels) {
+			if (!pixels.next(reader, pixel)) {
+				return false;
+			}
+		}
+	}
+
+	std::uint32_t stroke_count, visible;
+	if (!reader.read_varint(stroke_count) || !reader.read_varint(visible) || visible > stroke_count) {
+		return false;
+	}
+	out.visible = visible;
+	stroke_point end{ 0, 0 };
+	for (std::uint32_t s = 0; s < stroke_count; ++s) {
+		std::uint32_t header;
+		if (!reader.read_varint(header)) {
+			return false;
+		}
+		const std::uint32_t segment_count = header >> 1;
+		const bool fill = header & 1;
+		if (fill && segment_count != 1) {
+			return false;
+		}
+		out.strokes.push_back(out.segments.size());
+		if (segment_count > max_snapshot_segments - out.segments.size()) {
+			return false;
+		}
+		for (std::uint32_t i = 0; i < segment_count; ++i) {
+			int from_x, from_y, to_x, to_y;
+			unsigned char r, g, b, a;
+			if (!reader.read_signed(from_x) || !reader.read_signed(from_y) || !reader.read_signed(to_x) || !reader.read_signed(to_y)
+				|| !reader.read_byte(r) || !reader.read_byte(g) || !reader.read_byte(b) || !reader.read_byte(a)) {
+				return false;
+			}
+			stroke_segment segment;
+			segment.from = clamp_stroke_point({ end.x + from_x, end.y + from_y }, size);
+			segment.to = clamp_stroke_point({ segment.from.x + to_x, segment.from.y + to_y }, size);
+			segment.color = { r, g, b, a };
+			segment.fill = fill;
+			if (fill && !reader.read_byte(segment.tolerance)) {
+				return false;
+			}
+			out.segments.push_back(segment);
+			end = segment.to;
+		}
+	}
+
+	std::uint32_t has_pen;
+	if (!reader.read_varint(has_pen) || has_pen > 1) {
+		return false;
+	}
+	if (has_pen) {
+		int x, y;
+		if (!reader.read_signed(x) || !reader.read_signed(y)) {
+			return false;
+		}
+		const stroke_point pen = clamp_stroke_point({ static_cast<float>(x), static_cast<float>(y) }, size);
+		out.pen = sdl::point{ static_cast<int>(pen.x), static_cast<int>(pen.y) };
+	}
+	return reader.at_end();
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sdlw/sdlw.hpp>
+
+#include "Rasterizer.h"
+#include "TiledCanvas.h"
+
+// Stroke points are kept at most this far outside the canvas, so that a
+// point anywhere in the protocol's range cannot overflow the bounds of
+// what a segment draws. That moves the far end of a stroke that leaves the
+// canvas by more, which every client does alike.
+constexpr float stroke_margin = 16;
+
+// point, moved inside the canvas of size grown by stroke_margin each way.
+stroke_point clamp_stroke_point(stroke_point point, sdl::size size);
+
+struct stroke_segment {
+	stroke_point from;
+	stroke_point to;
+	sdl::color color;
+	// A paint bucket fill from from instead, as flood_filler::fill does. A
+	// stroke with a fill has no other segments.
+	bool fill = false;
+	std::uint8_t tolerance = 0;
+};
+
+// A canvas as sent to players who join mid-round, so they can show it in
+// one step instead of replaying the round: the pixels of the canvas after
+// its first base strokes, and the strokes after those, so undo and redo
+// keep working. Decoding it costs at most a canvas worth of tiles and
+// canvas::checkpoint_interval strokes, however long the round has been.
+struct canvas_snapshot {
+	struct tile {
+		int column;
+		int row;
+		tiled_canvas::tile pixels;
+	};
+
+	sdl::size size{};
+	// Strokes drawn into tiles.
+	std::size_t base = 0;
+	// Tiles that are not all background.
+	std::vector<tile> tiles;
+
+	// The strokes after base, as indexes of their first segment.
+	std::vector<std::size_t> strokes;
+	std::vector<stroke_segment> segments;
+	// How many of strokes are shown; the rest were undone.
+	std::size_t visible = 0;
+	// End of the stroke being drawn, if one is.
+	std::optional<sdl::point> pen;
+};
+
+// Snapshots may hold at most this many stroke segments, so that one sent by
+// a broken or hostile client cannot make the receiver allocate without
+// bound. A whole round of drawing takes a few thousand.
+constexpr std::size_t max_snapshot_segments = 64 * 1024;
+
+// The most a snapshot of a canvas of size decodes to before it is parsed:
+// every tile as whole pixels and max_snapshot_segments segments.
+std::size_t max_snapshot_data(sdl::size size);
+
+// The most characters encode_snapshot gives for a canvas of size.
+std::size_t max_snapshot_text(sdl::size size);
+
+// Encodes snapshot as text for the snapshot message: tile pixels as QOI
+// ops, strokes delta encoded, the whole compressed and in base64. Returns
+// an empty string if it has more than max_snapshot_segments segments.
+std::string encode_snapshot(const canvas_snapshot& snapshot);
+
+// Returns false if text is not a well-formed snapshot of a canvas of size.
+bool decode_snapshot(std::string_view text, sdl::size size, canvas_snapshot& out);
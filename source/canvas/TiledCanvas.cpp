@@ -0,0 +1,180 @@
+#include "TiledCanvas.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Half the diagonal of a tile: a stroke further than this plus its reach
+// from a tile's center cannot touch it.
+static const float tile_radius = tiled_canvas::tile_size * std::sqrt(2.0f) / 2;
+
+static float distance_to_segment(float x, float y, stroke_point a, stroke_point b)
+{
+	float dx = b.x - a.x;
+	float dy = b.y - a.y;
+	float length_squared = dx * dx + dy * dy;
+	float t = length_squared > 0 ? std::clamp(((x - a.x) * dx + (y - a.y) * dy) / length_squared, 0.0f, 1.0f) : 0;
+	return std::hypot(x - a.x - t * dx, y - a.y - t * dy);
+}
+
+std::uint32_t tiled_canvas::pixel(sdl::color color)
+{
+	return std::uint32_t{ 0xff } << 24 | std::uint32_t{ color.r } << 16 | std::uint32_t{ color.g } << 8 | color.b;
+}
+
+tiled_canvas::tiled_canvas(sdl::size size, sdl::color background)
+	: _size(size)
+	, _columns((size.width + tile_size - 1) / tile_size)
+	, _rows((size.height + tile_size - 1) / tile_size)
+	, _background(pixel(background))
+	, _tiles(static_cast<std::size_t>(_columns) * _rows)
+	, _dirty({ { 0, 0 }, size })
+{
+	auto blank = std::make_shared<tile>();
+	blank->fill(_background);
+	_blank = std::move(blank);
+}
+
+void tiled_canvas::draw_segment(const stroke_rasterizer& rasterizer, stroke_point from, stroke_point to, const stroke_point* previous, float width, sdl::color color)
+{
+	const float reach = std::max(width, 0.0f) / 2 + 1;
+	int first_column = std::max(0, static_cast<int>(std::floor((std::min(from.x, to.x) - reach) / tile_size)));
+	int last_column = std::min(_columns - 1, static_cast<int>(std::floor((std::max(from.x, to.x) + reach) / tile_size)));
+	int first_row = std::max(0, static_cast<int>(std::floor((std::min(from.y, to.y) - reach) / tile_size)));
+	int last_row = std::min(_rows - 1, static_cast<int>(std::floor((std::max(from.y, to.y) + reach) / tile_size)));
+
+	int left = static_cast<int>(std::floor(std::min(from.x, to.x) - reach));
+	int top = static_cast<int>(std::floor(std::min(from.y, to.y) - reach));
+	int right = static_cast<int>(std::ceil(std::max(from.x, to.x) + reach));
+	int bottom = static_cast<int>(std::ceil(std::max(from.y, to.y) + reach));
+	_dirty.add({ { left, top }, { right - left + 1, bottom - top + 1 } });
+
+	raster_target target;
+	target.pitch = tile_size * sizeof(std::uint32_t);
+	for (int row = first_row; row <= last_row; ++row) {
+		for (int column = first_column; column <= last_column; ++column) {
+			float center_x = (column + 0.5f) * tile_size;
+			float center_y = (row + 0.5f) * tile_size;
+			if (distance_to_segment(center_x, center_y, from, to) > reach + tile_radius) {
+				continue;
+			}
+			target.pixels = writable_tile(column, row);
+			target.origin = { column * tile_size, row * tile_size };
+			target.clip = tile_area(column, row);
+			rasterizer.draw_segment(target, from, to, previous, width, pixel(color), color.a);
+		}
+	}
+}
+
+const std::uint32_t* tiled_canvas::tile_pixels(int column, int row) const
+{
+	const auto& t = _tiles[index(column, row)];
+	return t ? t->data() : nullptr;
+}
+
+std::uint32_t* tiled_canvas::writable_tile(int column, int row)
+{
+	std::size_t i = index(column, row);
+	auto& t = _tiles[i];
+	if (!t) {
+		t = std::make_shared<tile>(*_blank);
+	}
+	else if (t.use_count() > 1) {
+		// Shared with a copy of the canvas, which must not see this change.
+		t = std::make_shared<tile>(*t);
+	}
+	return t->data();
+}
+
+sdl::rect tiled_canvas::tile_area(int column, int row) const
+{
+	int x = column * tile_size;
+	int y = row * tile_size;
+	return { { x, y }, { std::min(tile_size, _size.width - x), std::min(tile_size, _size.height - y) } };
+}
+
+void tiled_canvas::clear()
+{
+	for (std::size_t i = 0; i < _tiles.size(); ++i) {
+		if (_tiles[i]) {
+			_tiles[i].reset();
+			_dirty.add(tile_area(static_cast<int>(i % _columns), static_cast<int>(i / _columns)));
+		}
+	}
+}
+
+void tiled_canvas::restore(const tiled_canvas& snapshot)
+{
+	for (std::size_t i = 0; i < _tiles.size(); ++i) {
+		if (_tiles[i] != snapshot._tiles[i]) {
+			_tiles[i] = snapshot._tiles[i];
+			_dirty.add(tile_area(static_cast<int>(i % _columns), static_cast<int>(i / _columns)));
+		}
+	}
+}
+
+void tiled_canvas::read(const sdl::rect& area, sdl::pixel_format_type format, void* pixels, int pitch) const
+{
+	auto* destination = static_cast<unsigned char*>(pixels);
+	const int bytes_per_pixel = sdl::bytes_per_pixel(format);
+	const int first_column = area.position.x / tile_size;
+	const int last_column = (area.position.x + area.size.width - 1) / tile_size;
+	const int first_row = area.position.y / tile_size;
+	const int last_row = (area.position.y + area.size.height - 1) / tile_size;
+	for (int row = first_row; row <= last_row; ++row) {
+		for (int column = first_column; column <= last_column; ++column) {
+			auto overlap = sdl::intersection(area, tile_area(column, row));
+			if (!overlap) {
+				continue;
+			}
+			const sdl::rect& part = *overlap;
+			const std::uint32_t* source = tile_pixels(column, row);
+			if (!source) {
+				source = _blank->data();
+			}
+			source += (part.position.y - row * tile_size) * tile_size + (part.position.x - column * tile_size);
+			unsigned char* target = destination
+				+ static_cast<std::ptrdiff_t>(part.position.y - area.position.y) * pitch
+				+ static_cast<std::ptrdiff_t>(part.position.x - area.position.x) * bytes_per_pixel;
+			sdl::convert_pixels(part.size.width, part.size.height, sdl::pixel_format_type::argb8888, source, tile_size * sizeof(std::uint32_t), format, target, pitch);
+		}
+	}
+}
+
+void tiled_canvas::upload(sdl::texture& texture)
+{
+	for (const sdl::rect& area : _dirty.take()) {
+		auto [pixels, pitch] = texture.lock(area);
+		read(area, sdl::pixel_format_type::argb8888, pixels, pitch);
+		texture.unlock();
+	}
+}
+
+void tiled_canvas::upload(sdl::window& window)
+{
+	if (_dirty.empty()) {
+		return;
+	}
+	sdl::surface_ref surface = window.surface();
+	const auto format = surface.format().format();
+	const bool locking = surface.must_lock();
+	if (locking) {
+		surface.lock();
+	}
+	std::vector<sdl::rect> areas = _dirty.take();
+	for (const sdl::rect& area : areas) {
+		auto* pixels = static_cast<unsigned char*>(surface.pixels())
+			+ static_cast<std::ptrdiff_t>(area.position.y) * surface.pitch()
+			+ static_cast<std::ptrdiff_t>(area.position.x) * sdl::bytes_per_pixel(format);
+		read(area, format, pixels, surface.pitch());
+	}
+	if (locking) {
+		surface.unlock();
+	}
+	window.update_surface_areas({ areas.data(), static_cast<int>(areas.size()) });
+}
+
+std::size_t tiled_canvas::memory() const
+{
+	auto allocated = std::count_if(_tiles.begin(), _tiles.end(), [](const auto& t) { return t != nullptr; });
+	return static_cast<std::size_t>(allocated) * sizeof(tile);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <sdlw/sdlw.hpp>
+
+#include "DirtyRegion.h"
+#include "Rasterizer.h"
+
+// Canvas pixels in ARGB8888, stored as square tiles that are only allocated
+// once something is drawn on them, so memory follows the ink rather than
+// the canvas size. Copies share their tiles until either side draws on one,
+// which makes snapshots cheap.
+//
+// The changed parts of the canvas are tracked as a few dirty rectangles,
+// and only those are copied out on upload.
+class tiled_canvas {
+public:
+	static constexpr int tile_size = 64;
+	using tile = std::array<std::uint32_t, tile_size * tile_size>;
+
+	tiled_canvas(sdl::size size, sdl::color background);
+
+	sdl::size size() const { return _size; }
+	int columns() const { return _columns; }
+	int rows() const { return _rows; }
+	std::uint32_t background() const { return _background; }
+
+	// Draws a segment as stroke_rasterizer::draw_segment does, allocating
+	// only the tiles the stroke reaches.
+	void draw_segment(const stroke_rasterizer& rasterizer, stroke_point from, stroke_point to, const stroke_point* previous, float width, sdl::color color);
+
+	// The pixels of the tile in column, row, or null if it is all
+	// background. Rows are tile_size pixels apart.
+	const std::uint32_t* tile_pixels(int column, int row) const;
+
+	// The tile's pixels for drawing on, allocated or unshared first. The
+	// caller marks what it changes dirty.
+	std::uint32_t* writable_tile(int column, int row);
+
+	// The canvas area the tile covers; edge tiles are cut to the canvas.
+	sdl::rect tile_area(int column, int row) const;
+
+	// Back to all background, freeing every tile.
+	void clear();
+
+	// Back to the pixels of snapshot, an earlier copy of this canvas, sharing
+	// its tiles. Only tiles that differ from it become dirty.
+	void restore(const tiled_canvas& snapshot);
+
+	// Copies area, which must lie within the canvas, into pixels converted
+	// to format.
+	void read(const sdl::rect& area, sdl::pixel_format_type format, void* pixels, int pitch) const;
+
+	// Copies the dirty areas into texture, which must be streaming and as
+	// big as the canvas, and marks them clean.
+	void upload(sdl::texture& texture);
+
+	// Copies the dirty areas onto the window's surface, updates them on
+	// screen and marks them clean. For windows without a renderer.
+	void upload(sdl::window& window);
+
+	void mark_dirty(const sdl::rect& area) { _dirty.add(area); }
+
+	// Makes everything dirty, e.g. when the texture lost its contents.
+	void mark_all_dirty() { _dirty.add_all(); }
+
+	const dirty_region& dirty() const { return _dirty; }
+
+	// Bytes of tile memory this canvas holds, shared tiles included.
+	std::size_t memory() const;
+
+	static std::uint32_t pixel(sdl::color color);
+
+private:
+	std::size_t index(int column, int row) const { return static_cast<std::size_t>(row) * _columns + column; }
+
+	sdl::size _size;
+	int _columns;
+	int _rows;
+	std::uint32_t _background;
+	std::vector<std::shared_ptr<tile>> _tiles;
+	dirty_region _dirty;
+	// Background pixels for uploading tiles that are not allocated.
+	std::shared_ptr<const tile> _blank;
+};
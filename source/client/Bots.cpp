@@ -0,0 +1,62 @@
+#include "Bots.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <variant>
+
+#include <sockets/sockets.hpp>
+
+#include "../protocol/Protocol.h"
+#include "Client.h"
+#include "EventLoop.h"
+#include "Session.h"
+#include "Task.h"
+
+// A drawing bot's line runs from one corner of the canvas towards the
+// other, a point per interval, about as fast as a hand draws.
+static constexpr proto::integer line_points = 32;
+static constexpr proto::integer line_start = 100;
+static constexpr proto::integer line_step = 16;
+static constexpr std::chrono::milliseconds point_interval{ 16 };
+
+static task<void> draw_line(event_loop& loop, session& server)
+{
+	proto::line_message point;
+	point.a = 255;
+	for (proto::integer i = 0; i < line_points; ++i) {
+		point.x = line_start + i * line_step;
+		point.y = line_start + i * line_step / 2;
+		co_await server.send(proto::to_json(point));
+		co_await loop.sleep_for(point_interval);
+	}
+	co_await server.send(proto::to_json(proto::end_line_message{}));
+}
+
+static task<void> bot(event_loop& loop, std::string name)
+{
+	session server{ loop };
+	co_await server.connect(server_name, server_port);
+	proto::username_message username;
+	username.username = name;
+	co_await server.send(proto::to_json(username));
+	for (;;) {
+		incoming_message message = co_await server.next_message();
+		std::cout << name << ": " << proto::wire_name(proto::type_of(message.message)) << std::endl;
+		auto started = std::get_if<proto::game_started_message>(&message.message);
+		if (started && started->drawer == name) {
+			co_await draw_line(loop, server);
+		}
+	}
+}
+
+int run_bots(int count)
+{
+	winsock_library winsock;
+	event_loop loop;
+	for (int i = 1; i <= count; ++i) {
+		loop.spawn(bot(loop, "bot" + std::to_string(i)));
+	}
+	loop.run();
+	return 0;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// Joins count players named bot1, bot2 and so on to the game server, all
+// on this thread, so a round can be played with a single window. Each bot
+// prints the type of every message it receives, and one chosen to draw
+// draws a line across the canvas. Returns once the server has closed every
+// connection.
+int run_bots(int count);
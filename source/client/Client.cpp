@@ -2,69 +2,253 @@
 
 #include <algorithm>
 #include <iostream>
-#include <thread>
+#include <iterator>
+#include <optional>
 
-#include <rigtorp/SPSCQueue.h>
-#include <sockets/sockets.hpp>
+// The capabilitiesAck is requested by the receiver, not queued on outgoing,
+// so the sender also wakes up this often to check for it. The receiver
+// checks for a stop this often while waiting on a full incoming queue.
+static constexpr std::chrono::milliseconds pending_poll_interval{ 50 };
 
-static constexpr const char* server_name = "localhost";
-static constexpr short server_port = 9004;
+// The incoming queue grows while the reader lags behind, so the receiver
+// keeps draining the socket. Only once the queue and the frames of the
+// messages in it take this much memory does it wait.
+static constexpr std::size_t incoming_memory_limit = 64 * 1024 * 1024;
 
-static tcp_socket server{ INVALID_SOCKET };
-static rigtorp::SPSCQueue<json> incoming{ 1024 };
-static rigtorp::SPSCQueue<json> outgoing{ 1024 };
+static void incoming_full(std::size_t bytes)
+{
+	std::cerr << "Incoming messages and their frames use " << bytes / (1024 * 1024) << " MiB. Waiting for the reader to catch up." << std::endl;
+}
+
+client::client(const char* host, u16 port, std::function<bool()> on_incoming, const thread_layout& threads)
+	: _server{ host, port }
+	, _incoming{ incoming_memory_limit, incoming_full }
+	, _on_incoming{ std::move(on_incoming) }
+{
+	_receiver = start_thread(threads.receiver, [this](std::stop_token stop) { receive_messages(std::move(stop)); });
+	try {
+		_sender = start_thread(threads.sender, [this](std::stop_token stop) { send_messages(std::move(stop)); });
+	}
+	catch (...) {
+		// Lets the receiver's jthread join.
+		_receiver.request_stop();
+		_server.shutdown(SD_BOTH);
+		throw;
+	}
+}
+
+client::~client()
+{
+	stop(clock::now());
+}
 
-static void receive_messages()
+bool client::stop(clock::time_point deadline)
+{
+	if (!_sender.joinable()) {
+		return _flushed;
+	}
+
+	_drain_deadline.store(deadline.time_since_epoch().count(), std::memory_order_relaxed);
+	_sender.request_stop();
+	_receiver.request_stop();
+	_outgoing.wake_consumer();
+	{
+		std::unique_lock lock{ _sender_mutex };
+		_sender_done.wait_until(lock, deadline, [this] { return _sender_finished; });
+	}
+
+	// Returns the receiver from recv, and the sender from a send the server
+	// is not reading, if it is still at it past the deadline.
+	_server.shutdown(SD_BOTH);
+	_sender.join();
+	_receiver.join();
+	return _flushed;
+}
+
+void client::receive_messages(std::stop_token stop)
 try {
-	std::string buffer;
+	std::vector<incoming_message> messages;
 	for (;;) {
-		buffer += server.receive();
-		for (;;) {
-			auto message_end = std::find(buffer.begin(), buffer.end(), '\n');
-			if (message_end == buffer.end()) {
-				break;
+		std::string data = _server.receive();
+		if (data.empty()) {
+			if (stop.stop_requested()) {
+				return;
+			}
+			throw std::runtime_error{ "Server closed the connection." };
+		}
+		_connection.receive(data.data(), data.size(), messages);
+		for (std::size_t pushed = 0; pushed < messages.size();) {
+			pushed += _incoming.push_n(std::make_move_iterator(messages.begin() + pushed), messages.size() - pushed);
+			if (pushed < messages.size()) {
+				// At the memory limit. Wait for the reader to make room.
+				while (!_incoming.wait_push(std::move(messages[pushed]), pending_poll_interval)) {
+					if (stop.stop_requested()) {
+						return;
+					}
+				}
+				++pushed;
 			}
-			incoming.push(json::parse(buffer.begin(), message_end));
-			buffer.erase(buffer.begin(), message_end + 1);
 		}
+		if (!messages.empty() && _on_incoming && !_incoming_signalled.exchange(true, std::memory_order_acq_rel) && !_on_incoming()) {
+			// The reader was not woken, so let the next batch try again.
+			_incoming_signalled.store(false, std::memory_order_release);
+		}
+		messages.clear();
 	}
 }
 catch (const std::exception& e) {
-	std::cerr << "Receiver stopped. " << e.what() << std::endl;
+	if (!stop.stop_requested()) {
+		std::cerr << "Receiver stopped. " << e.what() << std::endl;
+	}
 }
 
-static void send_messages()
+void client::send_messages(std::stop_token stop)
 try {
+	std::string batch;
 	for (;;) {
-		if (json* message = outgoing.front()) {
-			server.send(message->dump() + '\n');
-			outgoing.pop();
+		// Once asked to stop, it drains outgoing without waiting.
+		bool stopping = stop.stop_requested();
+		if (!stopping) {
+			_outgoing.wait_front(pending_poll_interval, [&] { return stop.stop_requested(); });
+		}
+		_connection.write_pending(batch);
+		auto messages = _outgoing.front_n(_connection.max_batch());
+		for (auto span : { messages.first, messages.second }) {
+			for (std::size_t i = 0; i < span.size; ++i) {
+				_connection.write(span.data[i]);
+			}
+		}
+		_outgoing.pop_n(messages.size());
+		_connection.flush(batch);
+		if (!batch.empty()) {
+			_server.send(batch);
+			batch.clear();
+		}
+		if (stopping) {
+			if (_outgoing.empty()) {
+				_server.shutdown(SD_SEND);
+				finished_sending(true);
+				return;
+			}
+			if (clock::now().time_since_epoch().count() >= _drain_deadline.load(std::memory_order_relaxed)) {
+				finished_sending(false);
+				return;
+			}
 		}
 	}
 }
 catch (const std::exception& e) {
-	std::cerr << "Sender stopped. " << e.what() << std::endl;
+	if (!stop.stop_requested()) {
+		std::cerr << "Sender stopped. " << e.what() << std::endl;
+	}
+	finished_sending(false);
 }
 
-void start_client()
+void client::finished_sending(bool flushed)
 {
-	static winsock_library winsock;
-	server = { server_name, server_port };
-	std::thread{ receive_messages }.detach();
-	std::thread{ send_messages }.detach();
+	{
+		std::lock_guard lock{ _sender_mutex };
+		_sender_finished = true;
+		_flushed = flushed;
+	}
+	_sender_done.notify_all();
 }
 
-void send_message(json message)
+void client::send(json message)
 {
-	outgoing.push(std::move(message));
+	_outgoing.push(std::move(message));
 }
 
-bool next_message(json& message)
+bool client::next_message(incoming_message& message)
 {
-	if (json* front = incoming.front()) {
+	if (incoming_message* front = _incoming.front()) {
 		message = std::move(*front);
-		incoming.pop();
+		_incoming.pop();
 		return true;
 	}
 	return false;
-}
\ No newline at end of file
+}
+
+bool client::next_message(incoming_message& message, std::chrono::milliseconds timeout)
+{
+	if (incoming_message* front = _incoming.wait_front(timeout)) {
+		message = std::move(*front);
+		_incoming.pop();
+		return true;
+	}
+	return false;
+}
+
+std::size_t client::next_messages(std::vector<incoming_message>& messages, std::size_t max, std::chrono::milliseconds timeout)
+{
+	if (!_incoming.wait_front(timeout)) {
+		return 0;
+	}
+	return next_messages(messages, max);
+}
+
+std::size_t client::next_messages(std::vector<incoming_message>& messages, std::size_t max)
+{
+	// Acquires the receiver's exchange, so everything pushed before its last
+	// wake-up is visible below.
+	_incoming_signalled.exchange(false, std::memory_order_acq_rel);
+	auto ready = _incoming.front_n(max);
+	for (auto span : { ready.first, ready.second }) {
+		std::move(span.data, span.data + span.size, std::back_inserter(messages));
+	}
+	_incoming.pop_n(ready.size());
+	return ready.size();
+}
+
+client_stats client::stats() const
+{
+	client_stats stats;
+	stats.ingest = _connection.stats();
+	stats.negotiated = _connection.negotiated(stats.settings);
+	stats.compression = _connection.compression();
+	stats.incoming_queue = _incoming.stats();
+	stats.outgoing_queue = _outgoing.stats();
+	return stats;
+}
+
+static std::optional<client> game_client;
+
+void start_client(std::function<bool()> on_incoming, const thread_layout& threads)
+{
+	game_client.emplace(server_name, server_port, std::move(on_incoming), threads);
+}
+
+bool stop_client(client::clock::time_point deadline)
+{
+	return game_client->stop(deadline);
+}
+
+void send_message(json message)
+{
+	game_client->send(std::move(message));
+}
+
+bool next_message(incoming_message& message)
+{
+	return game_client->next_message(message);
+}
+
+bool next_message(incoming_message& message, std::chrono::milliseconds timeout)
+{
+	return game_client->next_message(message, timeout);
+}
+
+std::size_t next_messages(std::vector<incoming_message>& messages, std::size_t max, std::chrono::milliseconds timeout)
+{
+	return game_client->next_messages(messages, max, timeout);
+}
+
+std::size_t next_messages(std::vector<incoming_message>& messages, std::size_t max)
+{
+	return game_client->next_messages(messages, max);
+}
+
+client_stats get_client_stats()
+{
+	return game_client->stats();
+}
@@ -1,12 +1,129 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
 #include <json/json.hpp>
+#include <rigtorp/MPSCQueue.h>
+#include <rigtorp/SegmentedSPSCQueue.h>
+#include <rigtorp/SPSCQueue.h>
+#include <sockets/sockets.hpp>
+
+#include "../threading/ThreadConfig.h"
+#include "Connection.h"
 
 using namespace nlohmann;
 
-void start_client();
+struct client_stats {
+	ingest_stats ingest;
+	bool negotiated = false;
+	proto::settings settings;
+	compression_stats compression;
+	rigtorp::QueueStats incoming_queue;
+	rigtorp::QueueStats outgoing_queue;
+};
 
-void send_message(json message);
+// A connection to the server with a receiver and a sender thread. Each
+// client owns everything it uses, so any number of them can come and go.
+class client {
+public:
+	using clock = std::chrono::steady_clock;
+
+	// Connects and starts the threads, placed according to threads.
+	//
+	// on_incoming runs on the receiver thread when messages arrive and the
+	// reader has drained everything since the last call, so a burst of
+	// traffic wakes the reader once. It must not block or throw, and
+	// returns false if it could not wake the reader, to be called again
+	// with the next batch.
+	client(const char* host, u16 port, std::function<bool()> on_incoming = {}, const thread_layout& threads = default_thread_layout());
+
+	// Stops without waiting for queued messages to go out.
+	~client();
+
+	client(const client&) = delete;
+	client& operator=(const client&) = delete;
+
+	// Sends whatever is queued until deadline, then closes the connection
+	// and joins both threads. Returns false if messages were left unsent.
+	// Only the first call does anything.
+	bool stop(clock::time_point deadline);
+
+	// Safe to call from any thread. Messages sent by one thread go out in
+	// order. Messages sent once stop has begun may not go out.
+	void send(json message);
+
+	// Returns false when there are no messages in the queue.
+	bool next_message(incoming_message& message);
+
+	// Waits up to timeout for a message. Returns false if none arrived.
+	bool next_message(incoming_message& message, std::chrono::milliseconds timeout);
+
+	// Waits up to timeout for messages, then moves up to max of them to the
+	// end of messages at once. Returns how many were moved.
+	std::size_t next_messages(std::vector<incoming_message>& messages, std::size_t max, std::chrono::milliseconds timeout);
 
-// Returns false when there are no messages in the queue.
-bool next_message(json& message);
\ No newline at end of file
+	// Moves up to max waiting messages to the end of messages without
+	// waiting. Returns how many were moved. Call until it returns less than
+	// max after each on_incoming wake-up.
+	std::size_t next_messages(std::vector<incoming_message>& messages, std::size_t max);
+
+	// Safe to call from any thread.
+	client_stats stats() const;
+
+private:
+	void receive_messages(std::stop_token stop);
+	void send_messages(std::stop_token stop);
+	void finished_sending(bool flushed);
+
+	winsock_library _winsock;
+	tcp_socket _server;
+	connection _connection;
+	// Counts each message's frame against the memory limit too, as frames
+	// can be far bigger than the messages themselves.
+	struct frame_size {
+		std::size_t operator()(const incoming_message& message) const noexcept { return message.storage.capacity(); }
+	};
+	rigtorp::SegmentedSPSCQueue<incoming_message, 256, frame_size> _incoming;
+	// Any thread may send, so outgoing takes multiple producers.
+	rigtorp::MPSCQueue<json> _outgoing{ 1024 };
+	std::function<bool()> _on_incoming;
+	// Set once on_incoming has run, until the reader starts draining.
+	std::atomic<bool> _incoming_signalled{ false };
+
+	// When the sender gives up draining, set before it is asked to stop.
+	std::atomic<clock::rep> _drain_deadline{ 0 };
+	std::mutex _sender_mutex;
+	std::condition_variable _sender_done;
+	bool _sender_finished = false;
+	bool _flushed = false;
+
+	// Last, so the threads are joined before anything they use goes away.
+	std::jthread _receiver;
+	std::jthread _sender;
+};
+
+// The game server that start_client and the bots connect to.
+constexpr const char* server_name = "localhost";
+constexpr u16 server_port = 9004;
+
+// The client the rest of the program talks to, connected to the game
+// server. These wrap the members of the same name; call start_client first.
+void start_client(std::function<bool()> on_incoming = {}, const thread_layout& threads = default_thread_layout());
+
+// Leaves the client in place, so the functions below stay safe to call.
+bool stop_client(client::clock::time_point deadline);
+
+void send_message(json message);
+bool next_message(incoming_message& message);
+bool next_message(incoming_message& message, std::chrono::milliseconds timeout);
+std::size_t next_messages(std::vector<incoming_message>& messages, std::size_t max, std::chrono::milliseconds timeout);
+std::size_t next_messages(std::vector<incoming_message>& messages, std::size_t max);
+client_stats get_client_stats();
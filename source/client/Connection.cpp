@@ -0,0 +1,291 @@
+#include "Connection.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+// Compressed blocks bigger than this can only come from a corrupt stream.
+static constexpr std::size_t max_block_size = 1024 * 1024;
+// A block holds one batch, at most proto::max_batch_size frames that are
+// each at most connection::max_frame_size long plus their newline or
+// header, so one that inflates to more than this is corrupt too.
+static constexpr std::size_t max_inflated_block_size = proto::max_batch_size * (connection::max_frame_size + 16);
+
+// Each counter has a single writer, so a plain load and store is enough.
+static void add(std::atomic<std::uint64_t>& counter, std::uint64_t amount)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+static void count(std::atomic<std::uint64_t>& counter)
+{
+	add(counter, 1);
+}
+
+static std::uint64_t nanoseconds_since(std::chrono::steady_clock::time_point start)
+{
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+}
+
+void connection::receive(const char* data, std::size_t size, std::vector<incoming_message>& messages)
+{
+	if (_inflating) {
+		_compressed.append(data, size);
+		inflate();
+	}
+	else {
+		_buffer.append(data, size);
+	}
+	split_frames(messages);
+}
+
+void connection::split_frames(std::vector<incoming_message>& messages)
+{
+	// The settings can change between two frames of the same read, so each
+	// frame is split with the settings in force after the previous one.
+	std::size_t consumed = 0;
+	while (consumed < _buffer.size()) {
+		std::size_t used = _receive_settings.codec == proto::codec::binary
+			? take_binary_frame(consumed, messages)
+			: take_text_frame(consumed, messages);
+		if (used == 0) {
+			break;
+		}
+		consumed += used;
+
+		if (_receive_settings.compression != proto::compression::none && !_inflating) {
+			_inflating = true;
+			_compressed.assign(_buffer, consumed, std::string::npos);
+			_buffer.resize(consumed);
+			inflate();
+		}
+	}
+	_buffer.erase(0, consumed);
+	_scanned = consumed < _scanned ? _scanned - consumed : 0;
+}
+
+void connection::inflate()
+{
+	auto start = std::chrono::steady_clock::now();
+	std::size_t raw_before = _buffer.size();
+	std::size_t consumed = 0;
+	for (;;) {
+		const char* header = _compressed.data() + consumed;
+		const char* end = _compressed.data() + _compressed.size();
+		std::size_t block_size;
+		std::size_t header_size = proto::read_frame_header(header, end, block_size);
+		if (header_size == 0) {
+			break;
+		}
+		if (block_size > max_block_size) {
+			throw std::runtime_error{ "Compressed block is too big." };
+		}
+		if (static_cast<std::size_t>(end - header) - header_size < block_size) {
+			break;
+		}
+		if (!_decompressor.decompress(header + header_size, block_size, _buffer, max_inflated_block_size)) {
+			throw std::runtime_error{ "Compressed stream is corrupt." };
+		}
+		consumed += header_size + block_size;
+	}
+	_compressed.erase(0, consumed);
+
+	add(_compressed_received, consumed);
+	add(_raw_received, _buffer.size() - raw_before);
+	add(_decompress_nanoseconds, nanoseconds_since(start));
+}
+
+std::size_t connection::take_text_frame(std::size_t begin, std::vector<incoming_message>& messages)
+{
+	auto newline = std::find(_buffer.begin() + std::max(begin, _scanned), _buffer.end(), '\n');
+	if (newline == _buffer.end()) {
+		_scanned = _buffer.size();
+		if (_buffer.size() - begin > max_frame_size) {
+			if (!_discarding) {
+				count(_oversized);
+			}
+			_discarding = true;
+			return _buffer.size() - begin;
+		}
+		return 0;
+	}
+
+	auto end = static_cast<std::size_t>(newline - _buffer.begin());
+	if (_discarding) {
+		_discarding = false;
+	}
+	else if (end - begin > max_frame_size) {
+		count(_oversized);
+	}
+	else {
+		ingest(_buffer.data() + begin, _buffer.data() + end, messages);
+	}
+	_scanned = end + 1;
+	return end + 1 - begin;
+}
+
+std::size_t connection::take_binary_frame(std::size_t begin, std::vector<incoming_message>& messages)
+{
+	std::size_t available = _buffer.size() - begin;
+	if (_skip != 0) {
+		std::size_t skipped = std::min(_skip, available);
+		_skip -= skipped;
+		return skipped;
+	}
+
+	std::size_t payload_size;
+	const char* header = _buffer.data() + begin;
+	std::size_t header_size = proto::read_frame_header(header, header + available, payload_size);
+	if (header_size == 0) {
+		return 0;
+	}
+	if (payload_size > max_frame_size) {
+		count(_oversized);
+		_skip = payload_size;
+		return header_size;
+	}
+	if (available - header_size < payload_size) {
+		return 0;
+	}
+
+	const char* payload = header + header_size;
+	ingest(payload, payload + payload_size, messages);
+	return header_size + payload_size;
+}
+
+void connection::ingest(const char* begin, const char* end, std::vector<incoming_message>& messages)
+{
+	if (begin == end) {
+		return;
+	}
+
+	// Failed frames hand their storage to the next one.
+	std::vector<char> storage = std::move(_spare);
+	storage.assign(begin, end);
+
+	proto::message message;
+	char* first = storage.data();
+	char* last = storage.data() + storage.size();
+	proto::error error = _receive_settings.codec == proto::codec::binary
+		? proto::parse_binary(first, last, proto::direction::from_server, message)
+		: proto::parse_text(first, last, proto::direction::from_server, message);
+	if (error != proto::error::none) {
+		count(_rejected[static_cast<std::size_t>(error)]);
+		_spare = std::move(storage);
+		return;
+	}
+	count(_accepted);
+
+	if (auto capabilities = std::get_if<proto::capabilities_message>(&message)) {
+		handshake(*capabilities);
+	}
+	messages.push_back({ std::move(storage), message });
+}
+
+void connection::handshake(const proto::capabilities_message& capabilities)
+{
+	if (_negotiated.load(std::memory_order_relaxed)) {
+		return;
+	}
+	_negotiated_settings = proto::negotiate(proto::make_hello(), capabilities);
+	_receive_settings = _negotiated_settings;
+	_negotiated.store(true, std::memory_order_release);
+	_ack_pending.store(true, std::memory_order_release);
+}
+
+void connection::write(const nlohmann::json& message)
+{
+	if (_send_settings.codec == proto::codec::binary) {
+		proto::message typed;
+		proto::error error = proto::from_json(message, proto::direction::to_server, typed, _list_storage);
+		if (error != proto::error::none) {
+			std::cerr << "Dropped outgoing message. " << proto::describe(error) << std::endl;
+			return;
+		}
+		proto::write_binary_frame(typed, _batch);
+	}
+	else {
+		_batch += message.dump();
+		_batch += '\n';
+	}
+
+	if (!_hello_sent) {
+		auto type = message.find("type");
+		if (type != message.end() && *type == "username") {
+			proto::write_text(proto::make_hello(), _batch);
+			_batch += '\n';
+			_hello_sent = true;
+		}
+	}
+}
+
+void connection::write_pending(std::string& out)
+{
+	if (_ack_pending.exchange(false, std::memory_order_acquire)) {
+		flush(out);
+		proto::write_text(proto::capabilities_ack_message{}, out);
+		out += '\n';
+		_send_settings = _negotiated_settings;
+	}
+}
+
+void connection::flush(std::string& out)
+{
+	if (_batch.empty()) {
+		return;
+	}
+	if (_send_settings.compression == proto::compression::none) {
+		out += _batch;
+	}
+	else {
+		auto start = std::chrono::steady_clock::now();
+		std::string block;
+		_compressor.compress(_batch.data(), _batch.size(), block);
+		std::size_t header_begin = out.size();
+		proto::write_frame_header(block.size(), out);
+		out += block;
+		add(_raw_sent, _batch.size());
+		add(_compressed_sent, out.size() - header_begin);
+		add(_compress_nanoseconds, nanoseconds_since(start));
+	}
+	_batch.clear();
+}
+
+std::size_t connection::max_batch() const
+{
+	return static_cast<std::size_t>(_send_settings.max_batch);
+}
+
+ingest_stats connection::stats() const
+{
+	ingest_stats stats;
+	stats.accepted = _accepted.load(std::memory_order_relaxed);
+	stats.oversized = _oversized.load(std::memory_order_relaxed);
+	for (std::size_t i = 0; i < _rejected.size(); ++i) {
+		stats.rejected[i] = _rejected[i].load(std::memory_order_relaxed);
+	}
+	return stats;
+}
+
+compression_stats connection::compression() const
+{
+	compression_stats stats;
+	stats.raw_sent = _raw_sent.load(std::memory_order_relaxed);
+	stats.compressed_sent = _compressed_sent.load(std::memory_order_relaxed);
+	stats.compress_nanoseconds = _compress_nanoseconds.load(std::memory_order_relaxed);
+	stats.compressed_received = _compressed_received.load(std::memory_order_relaxed);
+	stats.raw_received = _raw_received.load(std::memory_order_relaxed);
+	stats.decompress_nanoseconds = _decompress_nanoseconds.load(std::memory_order_relaxed);
+	return stats;
+}
+
+bool connection::negotiated(proto::settings& settings) const
+{
+	if (!_negotiated.load(std::memory_order_acquire)) {
+		return false;
+	}
+	settings = _negotiated_settings;
+	return true;
+}
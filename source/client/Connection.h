@@ -0,0 +1,123 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <json/json.hpp>
+
+#include "../protocol/Capabilities.h"
+#include "../protocol/Compression.h"
+#include "../protocol/Protocol.h"
+
+// A validated message from the server. The text fields of message point
+// into storage, which moves along with it.
+struct incoming_message {
+	std::vector<char> storage;
+	proto::message message;
+};
+
+struct ingest_stats {
+	std::uint64_t accepted = 0;
+	std::uint64_t oversized = 0;
+	std::array<std::uint64_t, static_cast<std::size_t>(proto::error::count)> rejected{};
+};
+
+struct compression_stats {
+	std::uint64_t raw_sent = 0;
+	std::uint64_t compressed_sent = 0;
+	std::uint64_t compress_nanoseconds = 0;
+	std::uint64_t compressed_received = 0;
+	std::uint64_t raw_received = 0;
+	std::uint64_t decompress_nanoseconds = 0;
+};
+
+// Protocol state of one server connection, without any I/O.
+//
+// The receiving side turns the byte stream from the server into validated
+// messages. A frame that fails validation is counted and dropped on its
+// own; it never stops the frames after it.
+//
+// The sending side frames outgoing messages into batches. It follows the
+// username with a hello and switches to the negotiated settings once the
+// receiving side has seen the server's capabilities.
+//
+// With compression negotiated, each batch in either direction travels as
+// one block of the connection's compressed stream, prefixed by its varint
+// size.
+class connection {
+public:
+	// Frames longer than this are dropped without being parsed.
+	static constexpr std::size_t max_frame_size = 64 * 1024;
+
+	// Receiving side. Appends every message completed by data to messages.
+	void receive(const char* data, std::size_t size, std::vector<incoming_message>& messages);
+
+	// Sending side. Adds the framed message to the current batch.
+	void write(const nlohmann::json& message);
+
+	// Sending side. Appends handshake traffic the receiving side asked for.
+	void write_pending(std::string& out);
+
+	// Sending side. Appends the current batch to out, compressing it if
+	// that was negotiated.
+	void flush(std::string& out);
+
+	// Sending side. Most messages to put into one write.
+	std::size_t max_batch() const;
+
+	// Safe to call from any thread.
+	ingest_stats stats() const;
+
+	// Safe to call from any thread.
+	compression_stats compression() const;
+
+	// Safe to call from any thread. Returns false while the defaults are
+	// still in use.
+	bool negotiated(proto::settings& settings) const;
+
+private:
+	void split_frames(std::vector<incoming_message>& messages);
+	void inflate();
+	std::size_t take_text_frame(std::size_t begin, std::vector<incoming_message>& messages);
+	std::size_t take_binary_frame(std::size_t begin, std::vector<incoming_message>& messages);
+	void ingest(const char* begin, const char* end, std::vector<incoming_message>& messages);
+	void handshake(const proto::capabilities_message& capabilities);
+
+	// Receiving side.
+	std::string _buffer;
+	std::size_t _scanned = 0;
+	bool _discarding = false;
+	std::size_t _skip = 0;
+	std::vector<char> _spare;
+	proto::settings _receive_settings;
+	bool _inflating = false;
+	std::string _compressed;
+	proto::stream_decompressor _decompressor;
+
+	// Written once by the receiving side before _ack_pending is set.
+	proto::settings _negotiated_settings;
+	std::atomic<bool> _ack_pending{ false };
+	std::atomic<bool> _negotiated{ false };
+
+	// Sending side.
+	bool _hello_sent = false;
+	proto::settings _send_settings;
+	std::string _list_storage;
+	std::string _batch;
+	proto::stream_compressor _compressor;
+
+	std::atomic<std::uint64_t> _accepted{ 0 };
+	std::atomic<std::uint64_t> _oversized{ 0 };
+	std::array<std::atomic<std::uint64_t>, static_cast<std::size_t>(proto::error::count)> _rejected{};
+
+	std::atomic<std::uint64_t> _raw_sent{ 0 };
+	std::atomic<std::uint64_t> _compressed_sent{ 0 };
+	std::atomic<std::uint64_t> _compress_nanoseconds{ 0 };
+	std::atomic<std::uint64_t> _compressed_received{ 0 };
+	std::atomic<std::uint64_t> _raw_received{ 0 };
+	std::atomic<std::uint64_t> _decompress_nanoseconds{ 0 };
+};
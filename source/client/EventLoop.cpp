@@ -0,0 +1,97 @@
+#include "EventLoop.h"
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <thread>
+
+namespace {
+
+// Coroutine that nobody awaits. It destroys itself when it finishes.
+struct detached {
+	struct promise_type {
+		detached get_return_object() noexcept { return { std::coroutine_handle<promise_type>::from_promise(*this) }; }
+		std::suspend_always initial_suspend() const noexcept { return {}; }
+		std::suspend_never final_suspend() const noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept { std::terminate(); }
+	};
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+detached run_detached(task<void> work, std::size_t& tasks)
+{
+	try {
+		co_await work;
+	}
+	catch (const std::exception& e) {
+		std::cerr << "Task stopped. " << e.what() << std::endl;
+	}
+	--tasks;
+}
+
+} // namespace
+
+void event_loop::spawn(task<void> work)
+{
+	++_tasks;
+	_ready.push_back(run_detached(std::move(work), _tasks).handle);
+}
+
+void event_loop::run()
+{
+	while (_tasks != 0) {
+		while (!_ready.empty()) {
+			auto handle = _ready.front();
+			_ready.pop_front();
+			handle.resume();
+		}
+		if (_tasks == 0 || !wait_for_events()) {
+			break;
+		}
+	}
+}
+
+bool event_loop::wait_for_events()
+{
+	int timeout = -1;
+	if (!_timers.empty()) {
+		auto wait = std::chrono::ceil<std::chrono::milliseconds>(_timers.top().deadline - clock::now());
+		timeout = static_cast<int>(std::max<std::chrono::milliseconds::rep>(wait.count(), 0));
+	}
+
+	if (_waiters.empty()) {
+		if (timeout < 0) {
+			// Every task waits on something that can never happen.
+			std::cerr << "Event loop stalled with " << _tasks << " tasks left." << std::endl;
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds{ timeout });
+	}
+	else {
+		_poll_fds.clear();
+		for (const waiter& w : _waiters) {
+			_poll_fds.push_back({ w.socket, w.events, 0 });
+		}
+		if (::WSAPoll(_poll_fds.data(), static_cast<ULONG>(_poll_fds.size()), timeout) < 0) {
+			throw_wsa_error("WSAPoll");
+		}
+		// Errors and hang-ups resume the waiter too; its next call on the
+		// socket reports them.
+		for (std::size_t i = _waiters.size(); i-- != 0;) {
+			if (_poll_fds[i].revents != 0) {
+				_ready.push_back(_waiters[i].handle);
+				_waiters[i] = _waiters.back();
+				_waiters.pop_back();
+			}
+		}
+	}
+
+	auto now = clock::now();
+	while (!_timers.empty() && _timers.top().deadline <= now) {
+		_ready.push_back(_timers.top().handle);
+		_timers.pop();
+	}
+	return true;
+}
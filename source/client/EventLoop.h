@@ -0,0 +1,93 @@
+#pragma once
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <queue>
+#include <vector>
+
+#include <sockets/sockets.hpp>
+
+#include "Task.h"
+
+// Runs coroutines on the thread that calls run(). A coroutine suspends on a
+// timer or on a socket becoming readable or writable, and the loop resumes
+// it once that happens, so any number of them share the one thread without
+// blocking each other. Run one loop per thread to use more cores.
+//
+// Nothing here is thread-safe; a loop and its coroutines belong to one
+// thread.
+class event_loop {
+public:
+	using clock = std::chrono::steady_clock;
+
+	struct timer_awaiter {
+		event_loop& loop;
+		clock::time_point deadline;
+
+		bool await_ready() const { return clock::now() >= deadline; }
+		void await_suspend(std::coroutine_handle<> handle) { loop._timers.push({ deadline, handle }); }
+		void await_resume() const noexcept {}
+	};
+
+	struct socket_awaiter {
+		event_loop& loop;
+		SOCKET socket;
+		short events;
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle) { loop._waiters.push_back({ socket, events, handle }); }
+		void await_resume() const noexcept {}
+	};
+
+	struct yield_awaiter {
+		event_loop& loop;
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle) { loop._ready.push_back(handle); }
+		void await_resume() const noexcept {}
+	};
+
+	// Starts work on the next run(). The loop owns it until it finishes and
+	// logs whatever it throws.
+	void spawn(task<void> work);
+
+	// Resumes coroutines until every spawned task has finished.
+	void run();
+
+	timer_awaiter sleep_for(clock::duration duration) { return { *this, clock::now() + duration }; }
+	timer_awaiter sleep_until(clock::time_point deadline) { return { *this, deadline }; }
+
+	// Resumes once the socket can be read from, or has failed.
+	socket_awaiter readable(SOCKET socket) { return { *this, socket, POLLRDNORM }; }
+
+	// Resumes once the socket can be written to, or has failed.
+	socket_awaiter writable(SOCKET socket) { return { *this, socket, POLLWRNORM }; }
+
+	// Lets the other ready coroutines run first.
+	yield_awaiter yield() { return { *this }; }
+
+private:
+	struct timer {
+		clock::time_point deadline;
+		std::coroutine_handle<> handle;
+
+		bool operator>(const timer& other) const { return deadline > other.deadline; }
+	};
+
+	struct waiter {
+		SOCKET socket;
+		short events;
+		std::coroutine_handle<> handle;
+	};
+
+	bool wait_for_events();
+
+	std::deque<std::coroutine_handle<>> _ready;
+	std::priority_queue<timer, std::vector<timer>, std::greater<>> _timers;
+	std::vector<waiter> _waiters;
+	std::vector<WSAPOLLFD> _poll_fds;
+	std::size_t _tasks = 0;
+};
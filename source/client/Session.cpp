@@ -0,0 +1,106 @@
+#include "Session.h"
+
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+session::session(event_loop& loop)
+	: _loop(loop)
+{}
+
+task<void> session::connect(const char* host, u16 port)
+{
+	::addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	::addrinfo* found = nullptr;
+	if (int status = ::getaddrinfo(host, std::to_string(port).c_str(), &hints, &found); status != 0) {
+		throw std::runtime_error{ ::gai_strerrorA(status) };
+	}
+	std::unique_ptr<::addrinfo, decltype(&::freeaddrinfo)> addresses{ found, ::freeaddrinfo };
+
+	std::exception_ptr error;
+	for (const ::addrinfo* address = addresses.get(); address; address = address->ai_next) {
+		tcp_socket socket{ ::socket(address->ai_family, address->ai_socktype, address->ai_protocol) };
+		if (socket.native_handle() == INVALID_SOCKET) {
+			continue;
+		}
+		try {
+			socket.set_nonblocking(true);
+			if (!socket.try_connect(address->ai_addr, static_cast<int>(address->ai_addrlen))) {
+				co_await _loop.writable(socket.native_handle());
+				socket.finish_connect();
+			}
+		}
+		catch (const std::runtime_error&) {
+			error = std::current_exception();
+			continue;
+		}
+		_socket = std::move(socket);
+		co_return;
+	}
+	if (error) {
+		std::rethrow_exception(error);
+	}
+	throw std::runtime_error{ "Could not connect to the server." };
+}
+
+task<incoming_message> session::next_message()
+{
+	while (_incoming.empty()) {
+		co_await _loop.readable(_socket.native_handle());
+		_data.clear();
+		if (!_socket.try_receive(_data)) {
+			continue;
+		}
+		if (_data.empty()) {
+			throw std::runtime_error{ "Server closed the connection." };
+		}
+		_connection.receive(_data.data(), _data.size(), _received);
+		for (incoming_message& message : _received) {
+			_incoming.push_back(std::move(message));
+		}
+		_received.clear();
+
+		// Answers the server's capabilities right away.
+		_connection.write_pending(_out);
+		co_await write_out();
+	}
+	incoming_message message = std::move(_incoming.front());
+	_incoming.pop_front();
+	co_return message;
+}
+
+task<void> session::send(nlohmann::json message)
+{
+	_connection.write_pending(_out);
+	_connection.write(message);
+	_connection.flush(_out);
+	co_await write_out();
+}
+
+task<void> session::write_out()
+{
+	// The coroutine already writing picks up what was appended to _out.
+	if (_writing) {
+		co_return;
+	}
+	_writing = true;
+	try {
+		while (_written < _out.size()) {
+			std::size_t sent = _socket.try_send(_out.data() + _written, _out.size() - _written);
+			if (sent == 0) {
+				co_await _loop.writable(_socket.native_handle());
+			}
+			_written += sent;
+		}
+	}
+	catch (...) {
+		_writing = false;
+		throw;
+	}
+	_out.clear();
+	_written = 0;
+	_writing = false;
+}
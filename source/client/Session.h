@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <json/json.hpp>
+#include <sockets/sockets.hpp>
+
+#include "Connection.h"
+#include "EventLoop.h"
+#include "Task.h"
+
+// One connection to the server for coroutines running on an event_loop,
+// where the thread-based client needs two threads and two queues. Any
+// number of sessions can share one loop. Whoever runs them keeps a
+// winsock_library alive meanwhile, as client does.
+//
+//   task<void> bot(event_loop& loop)
+//   {
+//       session server{ loop };
+//       co_await server.connect("localhost", 9004);
+//       co_await server.send({ { "type", "username" }, { "username", "bot" } });
+//       for (;;) {
+//           incoming_message message = co_await server.next_message();
+//           ...
+//       }
+//   }
+//
+// Only one coroutine at a time may wait in next_message.
+class session {
+public:
+	explicit session(event_loop& loop);
+
+	// Connects to the first of host's addresses that accepts. Only looking
+	// up the name blocks the loop; the other sessions run while the
+	// connection is being made. Call it once, before anything else.
+	task<void> connect(const char* host, u16 port);
+
+	// Waits for the next message from the server. Throws once the server
+	// closes the connection.
+	task<incoming_message> next_message();
+
+	// Returns once the message is on the wire, or queued behind another
+	// send that is still waiting for the socket.
+	task<void> send(nlohmann::json message);
+
+	const connection& state() const { return _connection; }
+
+private:
+	task<void> write_out();
+
+	event_loop& _loop;
+	tcp_socket _socket{ INVALID_SOCKET };
+	connection _connection;
+
+	std::string _data;
+	std::vector<incoming_message> _received;
+	std::deque<incoming_message> _incoming;
+
+	std::string _out;
+	std::size_t _written = 0;
+	bool _writing = false;
+};
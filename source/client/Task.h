@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cassert>
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <variant>
+
+// A lazily started coroutine that produces a T. It runs when awaited and
+// resumes its awaiter when done, rethrowing whatever it threw.
+template<typename T = void>
+class task;
+
+namespace detail {
+
+// Resumes the awaiter of a finished task without growing the stack.
+struct final_awaiter {
+	bool await_ready() const noexcept { return false; }
+
+	template<typename Promise>
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> finished) noexcept
+	{
+		if (auto continuation = finished.promise().continuation) {
+			return continuation;
+		}
+		return std::noop_coroutine();
+	}
+
+	void await_resume() const noexcept {}
+};
+
+struct promise_base {
+	std::coroutine_handle<> continuation;
+
+	std::suspend_always initial_suspend() const noexcept { return {}; }
+	final_awaiter final_suspend() const noexcept { return {}; }
+};
+
+template<typename T>
+struct task_promise : promise_base {
+	std::variant<std::monostate, T, std::exception_ptr> result;
+
+	task<T> get_return_object() noexcept;
+	void return_value(T value) { result.template emplace<1>(std::move(value)); }
+	void unhandled_exception() noexcept { result.template emplace<2>(std::current_exception()); }
+
+	T take()
+	{
+		if (result.index() == 2) {
+			std::rethrow_exception(std::get<2>(result));
+		}
+		return std::move(std::get<1>(result));
+	}
+};
+
+template<>
+struct task_promise<void> : promise_base {
+	std::exception_ptr exception;
+
+	task<void> get_return_object() noexcept;
+	void return_void() noexcept {}
+	void unhandled_exception() noexcept { exception = std::current_exception(); }
+
+	void take()
+	{
+		if (exception) {
+			std::rethrow_exception(exception);
+		}
+	}
+};
+
+} // namespace detail
+
+template<typename T>
+class task {
+public:
+	using promise_type = ::detail::task_promise<T>;
+
+	explicit task(std::coroutine_handle<promise_type> handle) noexcept
+		: _handle(handle)
+	{}
+
+	task(task&& other) noexcept
+		: _handle(std::exchange(other._handle, nullptr))
+	{}
+
+	task& operator=(task&& other) noexcept
+	{
+		if (this != &other) {
+			if (_handle) {
+				_handle.destroy();
+			}
+			_handle = std::exchange(other._handle, nullptr);
+		}
+		return *this;
+	}
+
+	~task()
+	{
+		if (_handle) {
+			_handle.destroy();
+		}
+	}
+
+	auto operator co_await() noexcept
+	{
+		struct awaiter {
+			std::coroutine_handle<promise_type> handle;
+
+			// A task that was moved from has no coroutine to await.
+			bool await_ready() const noexcept
+			{
+				assert(handle);
+				return handle.done();
+			}
+
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+			{
+				handle.promise().continuation = awaiting;
+				return handle;
+			}
+
+			T await_resume() { return handle.promise().take(); }
+		};
+		return awaiter{ _handle };
+	}
+
+private:
+	std::coroutine_handle<promise_type> _handle;
+};
+
+namespace detail {
+
+template<typename T>
+task<T> task_promise<T>::get_return_object() noexcept
+{
+	return task<T>{ std::coroutine_handle<task_promise<T>>::from_promise(*this) };
+}
+
+inline task<void> task_promise<void>::get_return_object() noexcept
+{
+	return task<void>{ std::coroutine_handle<task_promise<void>>::from_promise(*this) };
+}
+
+} // namespace detail
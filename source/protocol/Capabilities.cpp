@@ -0,0 +1,77 @@
+#include "Capabilities.h"
+
+#include <algorithm>
+
+using namespace std::string_view_literals;
+
+namespace proto {
+
+static constexpr const char* codec_names[] = { "json", "binary" };
+static constexpr const char* compression_names[] = { "none", "lz" };
+static constexpr const char* lane_names[] = { "tcp", "udp" };
+
+const char* name(codec c)
+{
+	return codec_names[static_cast<std::size_t>(c)];
+}
+
+const char* name(compression c)
+{
+	return compression_names[static_cast<std::size_t>(c)];
+}
+
+hello_message make_hello()
+{
+	hello_message hello;
+	hello.codecs = text_list{ "binary\0json\0"sv, 2 };
+	hello.compression = text_list{ "lz\0none\0"sv, 2 };
+	hello.max_batch = max_batch_size;
+	hello.lanes = text_list{ "tcp\0"sv, 1 };
+	return hello;
+}
+
+template<std::size_t N>
+static bool find_name(const char* const (&names)[N], std::string_view name, std::size_t& index)
+{
+	for (std::size_t i = 0; i < N; ++i) {
+		if (name == names[i]) {
+			index = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool contains(const text_list& list, std::string_view name)
+{
+	return std::find(list.begin(), list.end(), name) != list.end();
+}
+
+template<typename Option, std::size_t N>
+static Option first_common(const char* const (&names)[N], const text_list& preferred, const text_list& supported, Option fallback)
+{
+	for (std::string_view name : preferred) {
+		std::size_t index;
+		if (find_name(names, name, index) && contains(supported, name)) {
+			return static_cast<Option>(index);
+		}
+	}
+	return fallback;
+}
+
+settings negotiate(const hello_message& client, const capabilities_message& server)
+{
+	settings result;
+	result.codec = first_common(codec_names, client.codecs, server.codecs, codec::json);
+	result.compression = first_common(compression_names, client.compression, server.compression, compression::none);
+	result.max_batch = std::clamp(std::min(client.max_batch, server.max_batch), 1, max_batch_size);
+	for (std::string_view name : client.lanes) {
+		std::size_t index;
+		if (find_name(lane_names, name, index) && contains(server.lanes, name)) {
+			result.lanes |= 1u << index;
+		}
+	}
+	return result;
+}
+
+} // namespace proto
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Protocol.h"
+
+// The hello/capabilities handshake. The client sends hello right after its
+// username, listing what it supports best first. A server that understands
+// it answers with capabilities, listing what it supports, and both ends run
+// negotiate() on the two lists to arrive at the same settings.
+namespace proto {
+
+enum class codec : unsigned char { json, binary };
+
+enum class compression : unsigned char { none, lz };
+
+enum lane : unsigned {
+	lane_tcp = 1 << 0,
+	lane_udp = 1 << 1
+};
+
+// The defaults are plain README NDJSON, which is what servers that ignore
+// hello keep speaking.
+struct settings {
+	proto::codec codec = codec::json;
+	proto::compression compression = compression::none;
+	integer max_batch = 1;
+	unsigned lanes = lane_tcp;
+};
+
+// Most messages this client puts into one write to the socket.
+inline constexpr integer max_batch_size = 64;
+
+const char* name(codec c);
+const char* name(compression c);
+
+hello_message make_hello();
+
+// Picks, in the client's order of preference, the first codec and the first
+// compression the server also supports. The batch size is the smaller of
+// the two and the lanes are the ones both support; TCP is always one.
+settings negotiate(const hello_message& client, const capabilities_message& server);
+
+} // namespace proto
@@ -0,0 +1,150 @@
+#include "Compression.h"
+
+#include <cstring>
+
+namespace proto {
+
+static constexpr std::size_t max_offset = 65535;
+static constexpr std::size_t min_match = 4;
+static constexpr int hash_bits = 12;
+
+// Once the window grows past this, everything but the last max_offset
+// bytes is dropped.
+static constexpr std::size_t window_limit = 4 * 65536;
+
+static std::uint32_t read32(const char* p)
+{
+	std::uint32_t value;
+	std::memcpy(&value, p, sizeof value);
+	return value;
+}
+
+static std::uint32_t hash(std::uint32_t sequence)
+{
+	return (sequence * 2654435761u) >> (32 - hash_bits);
+}
+
+static void put_length(std::size_t length, std::string& out)
+{
+	while (length >= 255) {
+		out += static_cast<char>(255);
+		length -= 255;
+	}
+	out += static_cast<char>(length);
+}
+
+static void put_sequence(const char* literals, std::size_t literal_count, std::size_t offset, std::size_t match_length, std::string& out)
+{
+	std::size_t match_code = match_length != 0 ? match_length - min_match : 0;
+	auto token = static_cast<unsigned char>((literal_count < 15 ? literal_count : 15) << 4 | (match_code < 15 ? match_code : 15));
+	out += static_cast<char>(token);
+	if (literal_count >= 15) put_length(literal_count - 15, out);
+	out.append(literals, literal_count);
+	if (match_length == 0) return;
+	out += static_cast<char>(offset & 0xFF);
+	out += static_cast<char>(offset >> 8);
+	if (match_code >= 15) put_length(match_code - 15, out);
+}
+
+stream_compressor::stream_compressor()
+	: _table(std::size_t{ 1 } << hash_bits, -1)
+{}
+
+void stream_compressor::compress(const char* data, std::size_t size, std::string& out)
+{
+	if (_window.size() + size > window_limit && _window.size() > max_offset) {
+		auto shift = static_cast<std::int32_t>(_window.size() - max_offset);
+		_window.erase(_window.begin(), _window.begin() + shift);
+		for (std::int32_t& position : _table) {
+			position = position >= shift ? position - shift : -1;
+		}
+	}
+
+	std::size_t begin = _window.size();
+	_window.insert(_window.end(), data, data + size);
+	const char* window = _window.data();
+	std::size_t end = _window.size();
+
+	std::size_t anchor = begin;
+	std::size_t position = begin;
+	while (position + min_match <= end) {
+		std::uint32_t sequence = read32(window + position);
+		std::int32_t& slot = _table[hash(sequence)];
+		std::int32_t candidate = slot;
+		slot = static_cast<std::int32_t>(position);
+
+		if (candidate < 0
+			|| position - static_cast<std::size_t>(candidate) > max_offset
+			|| read32(window + candidate) != sequence) {
+			++position;
+			continue;
+		}
+
+		std::size_t length = min_match;
+		while (position + length < end && window[candidate + length] == window[position + length]) {
+			++length;
+		}
+		put_sequence(window + anchor, position - anchor, position - static_cast<std::size_t>(candidate), length, out);
+		position += length;
+		anchor = position;
+	}
+	put_sequence(window + anchor, end - anchor, 0, 0, out);
+}
+
+static bool read_length(const unsigned char*& p, const unsigned char* end, std::size_t& length)
+{
+	for (;;) {
+		if (p == end) return false;
+		unsigned char byte = *p++;
+		length += byte;
+		if (byte != 255) return true;
+	}
+}
+
+bool stream_decompressor::decompress(const char* block, std::size_t size, std::string& out, std::size_t max_output)
+{
+	if (_window.size() > window_limit) {
+		_window.erase(_window.begin(), _window.end() - max_offset);
+	}
+
+	std::size_t begin = _window.size();
+	auto p = reinterpret_cast<const unsigned char*>(block);
+	auto end = p + size;
+	while (p != end) {
+		unsigned char token = *p++;
+
+		std::size_t literal_count = token >> 4;
+		if (literal_count == 15 && !read_length(p, end, literal_count)) return false;
+		if (static_cast<std::size_t>(end - p) < literal_count) return false;
+		if (literal_count > max_output - (_window.size() - begin)) return false;
+		_window.insert(_window.end(), p, p + literal_count);
+		p += literal_count;
+		if (p == end) break;
+
+		if (end - p < 2) return false;
+		std::size_t offset = p[0] | static_cast<std::size_t>(p[1]) << 8;
+		p += 2;
+		std::size_t match_length = token & 0x0F;
+		if (match_length == 15 && !read_length(p, end, match_length)) return false;
+		match_length += min_match;
+		if (offset == 0 || offset > _window.size()) return false;
+		if (match_length > max_output - (_window.size() - begin)) return false;
+
+		std::size_t target = _window.size();
+		_window.resize(target + match_length);
+		char* window = _window.data();
+		if (offset >= match_length) {
+			std::memcpy(window + target, window + target - offset, match_length);
+		}
+		else {
+			// The match overlaps the bytes it produces.
+			for (std::size_t i = 0; i < match_length; ++i) {
+				window[target + i] = window[target - offset + i];
+			}
+		}
+	}
+	out.append(_window.data() + begin, _window.size() - begin);
+	return true;
+}
+
+} // namespace proto
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Streaming LZ77 compression for the "lz" setting of the handshake.
+//
+// Each flush of the sender becomes one block. Matches may reach back into
+// earlier blocks of the same stream, up to 64 KiB, so repetitive traffic
+// like runs of line messages compresses well even when every block is
+// small. One compressor and one decompressor live as long as the
+// connection.
+//
+// A block is a sequence of LZ4-style sequences: a token byte whose high
+// nibble is the literal count and low nibble the match length minus 4
+// (15 means more length bytes follow, each adding up to 255), the
+// literals, a 2-byte little-endian offset and the extra match length
+// bytes. The last sequence of a block has literals only.
+namespace proto {
+
+class stream_compressor {
+public:
+	stream_compressor();
+
+	// Appends one compressed block holding data to out.
+	void compress(const char* data, std::size_t size, std::string& out);
+
+private:
+	std::vector<char> _window;
+	std::vector<std::int32_t> _table;
+};
+
+class stream_decompressor {
+public:
+	// Appends the contents of one block to out. Returns false if the block
+	// is corrupt or would hold more than max_output bytes, after which the
+	// stream cannot be recovered. Decoding stops as soon as the limit is
+	// passed, so a small block cannot make it allocate much more.
+	bool decompress(const char* block, std::size_t size, std::string& out, std::size_t max_output);
+
+private:
+	std::vector<char> _window;
+};
+
+} // namespace proto
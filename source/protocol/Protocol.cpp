@@ -0,0 +1,890 @@
+#include "Protocol.h"
+
+#include <cstring>
+#include <limits>
+
+#include "Varint.h"
+
+namespace proto {
+
+using nlohmann::json;
+
+struct type_info {
+	const char* wire_name;
+	direction travels;
+};
+
+static constexpr type_info types[] = {
+#define PROTOCOL_MESSAGE(name, wire, dir) { wire, direction::dir },
+#define PROTOCOL_FIELD(kind, name, wire)
+#define PROTOCOL_END(name)
+#include "Schema.def"
+#undef PROTOCOL_MESSAGE
+#undef PROTOCOL_FIELD
+#undef PROTOCOL_END
+};
+
+static_assert(std::size(types) == static_cast<std::size_t>(message_type::count));
+
+const char* describe(error e)
+{
+	switch (e) {
+	case error::none: return "no error";
+	case error::malformed: return "malformed frame";
+	case error::not_an_object: return "not an object";
+	case error::missing_type: return "missing type";
+	case error::unknown_type: return "unknown type";
+	case error::wrong_direction: return "wrong direction";
+	case error::missing_field: return "missing field";
+	case error::wrong_field_type: return "wrong field type";
+	case error::too_many_fields: return "too many fields";
+	default: return "unknown error";
+	}
+}
+
+message_type type_of(const message& m)
+{
+	return std::visit([](const auto& value) {
+		if constexpr (std::is_same_v<std::decay_t<decltype(value)>, std::monostate>) {
+			return message_type::count;
+		}
+		else {
+			return value.type;
+		}
+	}, m);
+}
+
+const char* wire_name(message_type type)
+{
+	return types[static_cast<std::size_t>(type)].wire_name;
+}
+
+message_type find_type(std::string_view wire_name)
+{
+	for (std::size_t i = 0; i < std::size(types); ++i) {
+		if (wire_name == types[i].wire_name) {
+			return static_cast<message_type>(i);
+		}
+	}
+	return message_type::count;
+}
+
+bool can_travel(message_type type, direction d)
+{
+	auto allowed = static_cast<unsigned>(types[static_cast<std::size_t>(type)].travels);
+	return (allowed & static_cast<unsigned>(d)) != 0;
+}
+
+// Text codec -----------------------------------------------------------------
+
+// Upper bound on the keys of one object. Anything bigger is not a message.
+static constexpr std::size_t max_fields = 16;
+
+enum class value_kind : unsigned char { integer, text, text_list, other };
+
+struct scanned_field {
+	std::string_view key;
+	value_kind kind = value_kind::other;
+	integer number = 0;
+	std::string_view string;
+	std::size_t count = 0;
+};
+
+static bool is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+static char* put_utf8(char* out, std::uint32_t code_point)
+{
+	if (code_point < 0x80) {
+		*out++ = static_cast<char>(code_point);
+	}
+	else if (code_point < 0x800) {
+		*out++ = static_cast<char>(0xC0 | (code_point >> 6));
+		*out++ = static_cast<char>(0x80 | (code_point & 0x3F));
+	}
+	else if (code_point < 0x10000) {
+		*out++ = static_cast<char>(0xE0 | (code_point >> 12));
+		*out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+		*out++ = static_cast<char>(0x80 | (code_point & 0x3F));
+	}
+	else {
+		*out++ = static_cast<char>(0xF0 | (code_point >> 18));
+		*out++ = static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+		*out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+		*out++ = static_cast<char>(0x80 | (code_point & 0x3F));
+	}
+	return out;
+}
+
+// Single pass JSON scanner for flat message objects. Strings are unescaped
+// in place; the decoded text is never longer than its escaped form.
+class text_scanner {
+	char* _position;
+	char* _end;
+
+public:
+	text_scanner(char* begin, char* end)
+		: _position{ begin }
+		, _end{ end }
+	{}
+
+	void skip_space()
+	{
+		while (_position != _end && is_space(*_position)) {
+			++_position;
+		}
+	}
+
+	bool at_end()
+	{
+		skip_space();
+		return _position == _end;
+	}
+
+	bool consume(char c)
+	{
+		skip_space();
+		if (_position != _end && *_position == c) {
+			++_position;
+			return true;
+		}
+		return false;
+	}
+
+	char peek()
+	{
+		skip_space();
+		return _position != _end ? *_position : '\0';
+	}
+
+	bool read_hex4(std::uint32_t& value)
+	{
+		if (_end - _position < 4) return false;
+		value = 0;
+		for (int i = 0; i < 4; ++i) {
+			int digit = hex_digit(*_position++);
+			if (digit < 0) return false;
+			value = value << 4 | static_cast<std::uint32_t>(digit);
+		}
+		return true;
+	}
+
+	bool read_string(std::string_view& out)
+	{
+		if (!consume('"')) return false;
+		char* start = _position;
+		char* write = _position;
+		while (_position != _end) {
+			char c = *_position++;
+			if (c == '"') {
+				out = std::string_view{ start, static_cast<std::size_t>(write - start) };
+				return true;
+			}
+			if (static_cast<unsigned char>(c) < 0x20) {
+				return false;
+			}
+			if (c != '\\') {
+				*write++ = c;
+				continue;
+			}
+			if (_position == _end) return false;
+			switch (*_position++) {
+			case '"': *write++ = '"'; break;
+			case '\\': *write++ = '\\'; break;
+			case '/': *write++ = '/'; break;
+			case 'b': *write++ = '\b'; break;
+			case 'f': *write++ = '\f'; break;
+			case 'n': *write++ = '\n'; break;
+			case 'r': *write++ = '\r'; break;
+			case 't': *write++ = '\t'; break;
+			case 'u': {
+				std::uint32_t code_point;
+				if (!read_hex4(code_point)) return false;
+				if (code_point >= 0xD800 && code_point < 0xDC00) {
+					std::uint32_t low;
+					if (_end - _position < 2 || _position[0] != '\\' || _position[1] != 'u') return false;
+					_position += 2;
+					if (!read_hex4(low) || low < 0xDC00 || low >= 0xE000) return false;
+					code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+				}
+				else if (code_point >= 0xDC00 && code_point < 0xE000) {
+					return false;
+				}
+				write = put_utf8(write, code_point);
+				break;
+			}
+			default:
+				return false;
+			}
+		}
+		return false;
+	}
+
+	// Reads any JSON number. Only integers that fit in 32 bits are
+	// reported as value_kind::integer.
+	bool read_number(scanned_field& field)
+	{
+		skip_space();
+		bool negative = _position != _end && *_position == '-';
+		if (negative) ++_position;
+		if (_position == _end || *_position < '0' || *_position > '9') return false;
+		std::int64_t value = 0;
+		bool overflow = false;
+		while (_position != _end && *_position >= '0' && *_position <= '9') {
+			if (!overflow) {
+				value = value * 10 + (*_position - '0');
+				overflow = value > std::int64_t{ 1 } << 32;
+			}
+			++_position;
+		}
+		bool fractional = false;
+		if (_position != _end && *_position == '.') {
+			fractional = true;
+			++_position;
+			if (_position == _end || *_position < '0' || *_position > '9') return false;
+			while (_position != _end && *_position >= '0' && *_position <= '9') ++_position;
+		}
+		if (_position != _end && (*_position == 'e' || *_position == 'E')) {
+			fractional = true;
+			++_position;
+			if (_position != _end && (*_position == '+' || *_position == '-')) ++_position;
+			if (_position == _end || *_position < '0' || *_position > '9') return false;
+			while (_position != _end && *_position >= '0' && *_position <= '9') ++_position;
+		}
+		if (negative) value = -value;
+		if (fractional || overflow
+			|| value < std::numeric_limits<integer>::min()
+			|| value > std::numeric_limits<integer>::max()) {
+			field.kind = value_kind::other;
+		}
+		else {
+			field.kind = value_kind::integer;
+			field.number = static_cast<integer>(value);
+		}
+		return true;
+	}
+
+	bool read_literal(const char* literal)
+	{
+		std::size_t length = std::strlen(literal);
+		if (static_cast<std::size_t>(_end - _position) < length) return false;
+		if (std::memcmp(_position, literal, length) != 0) return false;
+		_position += length;
+		return true;
+	}
+
+	// Skips a nested object or array without looking at its contents
+	// beyond what is needed to find where it ends. depth is the number of
+	// brackets already opened.
+	bool skip_nested(std::size_t depth = 0)
+	{
+		while (_position != _end) {
+			char c = *_position++;
+			if (c == '"') {
+				while (_position != _end && *_position != '"') {
+					if (*_position == '\\' && ++_position == _end) return false;
+					++_position;
+				}
+				if (_position == _end) return false;
+				++_position;
+			}
+			else if (c == '{' || c == '[') {
+				++depth;
+			}
+			else if (c == '}' || c == ']') {
+				if (--depth == 0) return true;
+			}
+		}
+		return false;
+	}
+
+	// Reads an array. Arrays of strings are packed in place, starting where
+	// the '[' was, into the layout text_list expects.
+	bool read_array(scanned_field& field)
+	{
+		char* packed_begin = _position;
+		char* packed_end = _position;
+		if (!consume('[')) return false;
+		field.kind = value_kind::text_list;
+		field.count = 0;
+		if (consume(']')) {
+			field.string = std::string_view{ packed_begin, 0 };
+			return true;
+		}
+		for (;;) {
+			if (peek() != '"') {
+				field.kind = value_kind::other;
+				return skip_nested(1);
+			}
+			std::string_view element;
+			if (!read_string(element)) return false;
+			if (element.find('\0') != std::string_view::npos) {
+				field.kind = value_kind::other;
+			}
+			std::memmove(packed_end, element.data(), element.size());
+			packed_end += element.size();
+			*packed_end++ = '\0';
+			++field.count;
+			if (consume(']')) break;
+			if (!consume(',')) return false;
+		}
+		field.string = std::string_view{ packed_begin, static_cast<std::size_t>(packed_end - packed_begin) };
+		return true;
+	}
+
+	bool read_value(scanned_field& field)
+	{
+		switch (peek()) {
+		case '"':
+			field.kind = value_kind::text;
+			return read_string(field.string);
+		case '[':
+			return read_array(field);
+		case '{':
+			field.kind = value_kind::other;
+			return skip_nested();
+		case 't':
+			field.kind = value_kind::other;
+			return read_literal("true");
+		case 'f':
+			field.kind = value_kind::other;
+			return read_literal("false");
+		case 'n':
+			field.kind = value_kind::other;
+			return read_literal("null");
+		default:
+			return read_number(field);
+		}
+	}
+};
+
+static const scanned_field* find_field(const scanned_field* fields, std::size_t count, std::string_view key)
+{
+	for (std::size_t i = 0; i < count; ++i) {
+		if (fields[i].key == key) {
+			return &fields[i];
+		}
+	}
+	return nullptr;
+}
+
+static error take_integer(const scanned_field* fields, std::size_t count, std::string_view key, integer& out)
+{
+	const scanned_field* field = find_field(fields, count, key);
+	if (!field) return error::missing_field;
+	if (field->kind != value_kind::integer) return error::wrong_field_type;
+	out = field->number;
+	return error::none;
+}
+
+static error take_text(const scanned_field* fields, std::size_t count, std::string_view key, text& out)
+{
+	const scanned_field* field = find_field(fields, count, key);
+	if (!field) return error::missing_field;
+	if (field->kind != value_kind::text) return error::wrong_field_type;
+	out = field->string;
+	return error::none;
+}
+
+static error take_text_list(const scanned_field* fields, std::size_t count, std::string_view key, text_list& out)
+{
+	const scanned_field* field = find_field(fields, count, key);
+	if (!field) return error::missing_field;
+	if (field->kind != value_kind::text_list) return error::wrong_field_type;
+	out = text_list{ field->string, field->count };
+	return error::none;
+}
+
+error parse_text(char* begin, char* end, direction from, message& out)
+{
+	text_scanner scanner{ begin, end };
+	if (scanner.peek() != '{') {
+		return scanner.at_end() ? error::malformed : error::not_an_object;
+	}
+	scanner.consume('{');
+
+	scanned_field fields[max_fields];
+	std::size_t count = 0;
+	std::string_view type_name;
+	bool has_type = false;
+
+	if (!scanner.consume('}')) {
+		for (;;) {
+			std::string_view key;
+			if (!scanner.read_string(key) || !scanner.consume(':')) return error::malformed;
+			if (key == "type") {
+				scanned_field type;
+				if (!scanner.read_value(type)) return error::malformed;
+				if (type.kind != value_kind::text) return error::wrong_field_type;
+				type_name = type.string;
+				has_type = true;
+			}
+			else {
+				if (count == max_fields) return error::too_many_fields;
+				scanned_field& field = fields[count++];
+				field.key = key;
+				if (!scanner.read_value(field)) return error::malformed;
+			}
+			if (scanner.consume('}')) break;
+			if (!scanner.consume(',')) return error::malformed;
+		}
+	}
+	if (!scanner.at_end()) return error::malformed;
+	if (!has_type) return error::missing_type;
+
+	message_type type = find_type(type_name);
+	if (type == message_type::count) return error::unknown_type;
+	if (!can_travel(type, from)) return error::wrong_direction;
+
+	error e = error::none;
+	switch (type) {
+#define PROTOCOL_MESSAGE(name, wire, dir) \
+	case message_type::name: {            \
+		name##_message m;
+#define PROTOCOL_FIELD(kind, name, wire) \
+		if ((e = take_##kind(fields, count, wire, m.name)) != error::none) return e;
+#define PROTOCOL_END(name) \
+		out = m;           \
+		return error::none; \
+	}
+#include "Schema.def"
+#undef PROTOCOL_MESSAGE
+#undef PROTOCOL_FIELD
+#undef PROTOCOL_END
+	default:
+		return error::unknown_type;
+	}
+}
+
+static void put_json_string(std::string_view s, std::string& out)
+{
+	static constexpr char hex[] = "0123456789abcdef";
+	out += '"';
+	for (char c : s) {
+		switch (c) {
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\b': out += "\\b"; break;
+		case '\f': out += "\\f"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20) {
+				out += "\\u00";
+				out += hex[(c >> 4) & 0xF];
+				out += hex[c & 0xF];
+			}
+			else {
+				out += c;
+			}
+		}
+	}
+	out += '"';
+}
+
+static void put_text_value(integer value, std::string& out)
+{
+	char digits[16];
+	char* end = digits + sizeof digits;
+	char* p = end;
+	std::int64_t v = value;
+	bool negative = v < 0;
+	if (negative) v = -v;
+	do {
+		*--p = static_cast<char>('0' + v % 10);
+		v /= 10;
+	} while (v != 0);
+	if (negative) *--p = '-';
+	out.append(p, end);
+}
+
+static void put_text_value(text value, std::string& out)
+{
+	put_json_string(value, out);
+}
+
+static void put_text_value(const text_list& value, std::string& out)
+{
+	out += '[';
+	bool first = true;
+	for (std::string_view element : value) {
+		if (!first) out += ',';
+		put_json_string(element, out);
+		first = false;
+	}
+	out += ']';
+}
+
+#define PROTOCOL_MESSAGE(name, wire, dir)                             \
+	static void write_text([[maybe_unused]] const name##_message& m, std::string& out) \
+	{                                                                 \
+		out += "{\"type\":\"" wire "\"";
+#define PROTOCOL_FIELD(kind, name, wire) \
+		out += ",\"" wire "\":";         \
+		put_text_value(m.name, out);
+#define PROTOCOL_END(name) \
+		out += '}';        \
+	}
+#include "Schema.def"
+#undef PROTOCOL_MESSAGE
+#undef PROTOCOL_FIELD
+#undef PROTOCOL_END
+
+static void write_text(std::monostate, std::string&)
+{}
+
+void write_text(const message& m, std::string& out)
+{
+	std::visit([&](const auto& value) { write_text(value, out); }, m);
+}
+
+// Binary codec ---------------------------------------------------------------
+
+static void put_binary_value(integer value, std::string& out)
+{
+	put_zigzag_varint(value, out);
+}
+
+static void put_binary_value(text value, std::string& out)
+{
+	put_varint(static_cast<std::uint32_t>(value.size()), out);
+	out.append(value.data(), value.size());
+}
+
+static void put_binary_value(const text_list& value, std::string& out)
+{
+	put_varint(static_cast<std::uint32_t>(value.size()), out);
+	for (std::string_view element : value) {
+		put_binary_value(element, out);
+	}
+}
+
+#define PROTOCOL_MESSAGE(name, wire, dir)                               \
+	static void write_binary([[maybe_unused]] const name##_message& m, std::string& out) \
+	{                                                                   \
+		out += static_cast<char>(message_type::name);
+#define PROTOCOL_FIELD(kind, name, wire) \
+		put_binary_value(m.name, out);
+#define PROTOCOL_END(name) \
+	}
+#include "Schema.def"
+#undef PROTOCOL_MESSAGE
+#undef PROTOCOL_FIELD
+#undef PROTOCOL_END
+
+static void write_binary(std::monostate, std::string&)
+{}
+
+void write_binary(const message& m, std::string& out)
+{
+	std::visit([&](const auto& value) { write_binary(value, out); }, m);
+}
+
+void write_frame_header(std::size_t payload_size, std::string& out)
+{
+	put_varint(static_cast<std::uint32_t>(payload_size), out);
+}
+
+void write_binary_frame(const message& m, std::string& out)
+{
+	std::size_t payload_begin = out.size();
+	write_binary(m, out);
+	std::string header;
+	put_varint(static_cast<std::uint32_t>(out.size() - payload_begin), header);
+	out.insert(payload_begin, header);
+}
+
+class binary_reader {
+	char* _position;
+	char* _end;
+
+public:
+	binary_reader(char* begin, char* end)
+		: _position{ begin }
+		, _end{ end }
+	{}
+
+	bool at_end() const
+	{
+		return _position == _end;
+	}
+
+	bool read_byte(unsigned char& out)
+	{
+		if (_position == _end) return false;
+		out = static_cast<unsigned char>(*_position++);
+		return true;
+	}
+
+	bool read_varint(std::uint32_t& out)
+	{
+		return proto::read_varint(_position, _end, out);
+	}
+
+	bool read(integer& out)
+	{
+		return read_zigzag_varint(_position, _end, out);
+	}
+
+	bool read(text& out)
+	{
+		std::uint32_t size;
+		if (!read_varint(size) || static_cast<std::size_t>(_end - _position) < size) return false;
+		out = std::string_view{ _position, size };
+		_position += size;
+		return true;
+	}
+
+	// Packs the strings in place, over their own length prefixes.
+	bool read(text_list& out)
+	{
+		std::uint32_t count;
+		if (!read_varint(count)) return false;
+		char* packed_begin = _position;
+		char* packed_end = _position;
+		for (std::uint32_t i = 0; i < count; ++i) {
+			std::string_view element;
+			if (!read(element) || element.find('\0') != std::string_view::npos) return false;
+			std::memmove(packed_end, element.data(), element.size());
+			packed_end += element.size();
+			*packed_end++ = '\0';
+		}
+		out = text_list{ std::string_view{ packed_begin, static_cast<std::size_t>(packed_end - packed_begin) }, count };
+		return true;
+	}
+};
+
+std::size_t read_frame_header(const char* begin, const char* end, std::size_t& payload_size)
+{
+	const char* position = begin;
+	std::uint32_t size;
+	if (!read_varint(position, end, size)) {
+		return 0;
+	}
+	payload_size = size;
+	return static_cast<std::size_t>(position - begin);
+}
+
+error parse_binary(char* begin, char* end, direction from, message& out)
+{
+	binary_reader reader{ begin, end };
+	unsigned char type_byte;
+	if (!reader.read_byte(type_byte)) return error::malformed;
+	if (type_byte >= static_cast<unsigned char>(message_type::count)) return error::unknown_type;
+	auto type = static_cast<message_type>(type_byte);
+	if (!can_travel(type, from)) return error::wrong_direction;
+
+	switch (type) {
+#define PROTOCOL_MESSAGE(name, wire, dir) \
+	case message_type::name: {            \
+		name##_message m;
+#define PROTOCOL_FIELD(kind, name, wire) \
+		if (!reader.read(m.name)) return error::malformed;
+#define PROTOCOL_END(name)                            \
+		if (!reader.at_end()) return error::malformed; \
+		out = m;                                      \
+		return error::none;                           \
+	}
+#include "Schema.def"
+#undef PROTOCOL_MESSAGE
+#undef PROTOCOL_FIELD
+#undef PROTOCOL_END
+	default:
+		return error::unknown_type;
+	}
+}
+
+// JSON values ----------------------------------------------------------------
+
+static error check_integer(const json& j, const char* key)
+{
+	auto it = j.find(key);
+	if (it == j.end()) return error::missing_field;
+	if (it->is_number_unsigned()) {
+		if (it->get<json::number_unsigned_t>() > static_cast<json::number_unsigned_t>(std::numeric_limits<integer>::max())) {
+			return error::wrong_field_type;
+		}
+		return error::none;
+	}
+	if (!it->is_number_integer()) return error::wrong_field_type;
+	auto value = it->get<json::number_integer_t>();
+	if (value < std::numeric_limits<integer>::min() || value > std::numeric_limits<integer>::max()) {
+		return error::wrong_field_type;
+	}
+	return error::none;
+}
+
+static error check_text(const json& j, const char* key)
+{
+	auto it = j.find(key);
+	if (it == j.end()) return error::missing_field;
+	return it->is_string() ? error::none : error::wrong_field_type;
+}
+
+static error check_text_list(const json& j, const char* key)
+{
+	auto it = j.find(key);
+	if (it == j.end()) return error::missing_field;
+	if (!it->is_array()) return error::wrong_field_type;
+	for (const json& element : *it) {
+		if (!element.is_string()) return error::wrong_field_type;
+		if (element.get_ref<const std::string&>().find('\0') != std::string::npos) return error::wrong_field_type;
+	}
+	return error::none;
+}
+
+error validate(const json& j, direction from)
+{
+	if (!j.is_object()) return error::not_an_object;
+	auto type_it = j.find("type");
+	if (type_it == j.end()) return error::missing_type;
+	if (!type_it->is_string()) return error::wrong_field_type;
+
+	message_type type = find_type(type_it->get_ref<const std::string&>());
+	if (type == message_type::count) return error::unknown_type;
+	if (!can_travel(type, from)) return error::wrong_direction;
+
+	error e = error::none;
+	switch (type) {
+#define PROTOCOL_MESSAGE(name, wire, dir) \
+	case message_type::name: {
+#define PROTOCOL_FIELD(kind, name, wire) \
+		if ((e = check_##kind(j, wire)) != error::none) return e;
+#define PROTOCOL_END(name) \
+		return error::none; \
+	}
+#include "Schema.def"
+#undef PROTOCOL_MESSAGE
+#undef PROTOCOL_FIELD
+#undef PROTOCOL_END
+	default:
+		return error::unknown_type;
+	}
+}
+
+static error take_json_value(const json& j, const char* key, integer& out)
+{
+	error e = check_integer(j, key);
+	if (e == error::none) out = j[key].get<integer>();
+	return e;
+}
+
+static error take_json_value(const json& j, const char* key, text& out)
+{
+	error e = check_text(j, key);
+	if (e == error::none) out = j[key].get_ref<const std::string&>();
+	return e;
+}
+
+static error take_json_value(const json& j, const char* key, text_list& out, std::string& storage)
+{
+	error e = check_text_list(j, key);
+	if (e != error::none) return e;
+	std::size_t packed_begin = storage.size();
+	for (const json& element : j[key]) {
+		storage += element.get_ref<const std::string&>();
+		storage += '\0';
+	}
+	out = text_list{ std::string_view{ storage }.substr(packed_begin), j[key].size() };
+	return error::none;
+}
+
+template<typename Value>
+static error take_json_value(const json& j, const char* key, Value& out, std::string&)
+{
+	return take_json_value(j, key, out);
+}
+
+error from_json(const json& j, direction from, message& out, std::string& storage)
+{
+	error e = validate(j, from);
+	if (e != error::none) return e;
+
+	// Reserve room for every list up front so packing one list never moves
+	// the ones before it.
+	std::size_t list_bytes = 0;
+	for (const json& value : j) {
+		if (value.is_array()) {
+			for (const json& element : value) {
+				if (element.is_string()) list_bytes += element.get_ref<const std::string&>().size() + 1;
+			}
+		}
+	}
+	storage.clear();
+	storage.reserve(list_bytes);
+
+	switch (find_type(j["type"].get_ref<const std::string&>())) {
+#define PROTOCOL_MESSAGE(name, wire, dir) \
+	case message_type::name: {            \
+		name##_message m;
+#define PROTOCOL_FIELD(kind, name, wire) \
+		take_json_value(j, wire, m.name, storage);
+#define PROTOCOL_END(name) \
+		out = m;           \
+		return error::none; \
+	}
+#include "Schema.def"
+#undef PROTOCOL_MESSAGE
+#undef PROTOCOL_FIELD
+#undef PROTOCOL_END
+	default:
+		return error::unknown_type;
+	}
+}
+
+static json json_value(integer value)
+{
+	return value;
+}
+
+static json json_value(text value)
+{
+	return std::string{ value };
+}
+
+static json json_value(const text_list& value)
+{
+	json array = json::array();
+	for (std::string_view element : value) {
+		array.push_back(std::string{ element });
+	}
+	return array;
+}
+
+#define PROTOCOL_MESSAGE(name, wire, dir)       \
+	static json to_json([[maybe_unused]] const name##_message& m) \
+	{                                           \
+		json j;                                 \
+		j["type"] = wire;
+#define PROTOCOL_FIELD(kind, name, wire) \
+		j[wire] = json_value(m.name);
+#define PROTOCOL_END(name) \
+		return j;          \
+	}
+#include "Schema.def"
+#undef PROTOCOL_MESSAGE
+#undef PROTOCOL_FIELD
+#undef PROTOCOL_END
+
+static json to_json(std::monostate)
+{
+	return nullptr;
+}
+
+json to_json(const message& m)
+{
+	return std::visit([](const auto& value) { return to_json(value); }, m);
+}
+
+} // namespace proto
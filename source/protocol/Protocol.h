@@ -0,0 +1,180 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <variant>
+
+#include <json/json.hpp>
+
+// Typed messages and codecs generated from Schema.def.
+//
+// The parsers never allocate. They decode strings in place, so the buffer
+// passed to them must be writable, and the text fields of the resulting
+// message point into it. Keep the buffer alive for as long as the message.
+namespace proto {
+
+enum class direction : unsigned char {
+	to_server = 1,
+	from_server = 2,
+	both = to_server | from_server
+};
+
+enum class message_type : unsigned char {
+#define PROTOCOL_MESSAGE(name, wire, dir) name,
+#define PROTOCOL_FIELD(kind, name, wire)
+#define PROTOCOL_END(name)
+#include "Schema.def"
+#undef PROTOCOL_MESSAGE
+#undef PROTOCOL_FIELD
+#undef PROTOCOL_END
+	count
+};
+
+enum class error : unsigned char {
+	none,
+	malformed,
+	not_an_object,
+	missing_type,
+	unknown_type,
+	wrong_direction,
+	missing_field,
+	wrong_field_type,
+	too_many_fields,
+	count
+};
+
+const char* describe(error e);
+
+using integer = std::int32_t;
+using text = std::string_view;
+
+// A list of strings stored back to back, each terminated by '\0'.
+class text_list {
+	std::string_view _packed;
+	std::size_t _size = 0;
+
+public:
+	class iterator {
+		const char* _position = nullptr;
+
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = std::string_view;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const std::string_view*;
+		using reference = std::string_view;
+
+		iterator() = default;
+
+		explicit iterator(const char* position)
+			: _position{ position }
+		{}
+
+		std::string_view operator*() const
+		{
+			return std::string_view{ _position };
+		}
+
+		iterator& operator++()
+		{
+			_position += std::char_traits<char>::length(_position) + 1;
+			return *this;
+		}
+
+		iterator operator++(int)
+		{
+			iterator previous = *this;
+			++*this;
+			return previous;
+		}
+
+		friend bool operator==(iterator x, iterator y) { return x._position == y._position; }
+		friend bool operator!=(iterator x, iterator y) { return x._position != y._position; }
+	};
+
+	text_list() = default;
+
+	text_list(std::string_view packed, std::size_t size)
+		: _packed{ packed }
+		, _size{ size }
+	{}
+
+	std::string_view packed() const { return _packed; }
+	std::size_t size() const { return _size; }
+	bool empty() const { return _size == 0; }
+	iterator begin() const { return iterator{ _packed.data() }; }
+	iterator end() const { return iterator{ _packed.data() + _packed.size() }; }
+};
+
+#define PROTOCOL_MESSAGE(name, wire, dir)                               \
+	struct name##_message {                                             \
+		static constexpr message_type type = message_type::name;        \
+		static constexpr const char* wire_name = wire;                  \
+		static constexpr proto::direction direction = proto::direction::dir;
+#define PROTOCOL_FIELD(kind, name, wire) kind name{};
+#define PROTOCOL_END(name) };
+#include "Schema.def"
+#undef PROTOCOL_MESSAGE
+#undef PROTOCOL_FIELD
+#undef PROTOCOL_END
+
+using message = std::variant<
+	std::monostate
+#define PROTOCOL_MESSAGE(name, wire, dir) , name##_message
+#define PROTOCOL_FIELD(kind, name, wire)
+#define PROTOCOL_END(name)
+#include "Schema.def"
+#undef PROTOCOL_MESSAGE
+#undef PROTOCOL_FIELD
+#undef PROTOCOL_END
+>;
+
+// Returns message_type::count for an empty message.
+message_type type_of(const message& m);
+
+const char* wire_name(message_type type);
+
+// Returns message_type::count for names not in the schema.
+message_type find_type(std::string_view wire_name);
+
+bool can_travel(message_type type, direction d);
+
+// Parses one JSON object, e.g. a single NDJSON line without the '\n'.
+error parse_text(char* begin, char* end, direction from, message& out);
+
+// Parses one binary payload as written by write_binary.
+error parse_binary(char* begin, char* end, direction from, message& out);
+
+// Appends the message as a single-line JSON object, without the '\n'.
+void write_text(const message& m, std::string& out);
+
+// Appends the message in the binary encoding: a type byte followed by the
+// fields in schema order. Integers are zigzag varints, strings are a varint
+// length followed by the bytes and lists are a varint count followed by
+// their strings.
+void write_binary(const message& m, std::string& out);
+
+// Appends the message as a binary frame: a varint payload length followed
+// by the write_binary payload.
+void write_binary_frame(const message& m, std::string& out);
+
+// Appends a varint frame header announcing payload_size bytes.
+void write_frame_header(std::size_t payload_size, std::string& out);
+
+// Reads a binary frame header. Returns the number of header bytes, or 0 if
+// the header is not complete yet.
+std::size_t read_frame_header(const char* begin, const char* end, std::size_t& payload_size);
+
+// Checks that an already parsed JSON value is a well-formed message.
+error validate(const nlohmann::json& j, direction from);
+
+// Converts a JSON value into a typed message. Text fields point into j and
+// lists are packed into storage, so both must outlive the message.
+error from_json(const nlohmann::json& j, direction from, message& out, std::string& storage);
+
+nlohmann::json to_json(const message& m);
+
+} // namespace proto
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Variable-length integers, as the binary codec and canvas snapshots write
+// them: seven bits per byte, lowest first, with the top bit set on every
+// byte but the last. Signed values are zigzag encoded first, so that small
+// negative numbers stay short too.
+namespace proto {
+
+// The longest a 32-bit varint gets.
+constexpr std::size_t max_varint_size = 5;
+
+inline void put_varint(std::uint32_t value, std::string& out)
+{
+	while (value >= 0x80) {
+		out += static_cast<char>(value | 0x80);
+		value >>= 7;
+	}
+	out += static_cast<char>(value);
+}
+
+inline void put_zigzag_varint(std::int32_t value, std::string& out)
+{
+	auto v = static_cast<std::uint32_t>(value);
+	put_varint(v << 1 ^ (value < 0 ? ~std::uint32_t{ 0 } : 0), out);
+}
+
+// Reads a varint at position and moves position past it. Returns false if
+// it does not end before end, or within max_varint_size bytes.
+template<typename Char>
+bool read_varint(Char*& position, Char* end, std::uint32_t& out)
+{
+	out = 0;
+	for (std::size_t i = 0; i < max_varint_size; ++i) {
+		if (position == end) return false;
+		auto byte = static_cast<unsigned char>(*position++);
+		out |= static_cast<std::uint32_t>(byte & 0x7F) << (7 * i);
+		if ((byte & 0x80) == 0) return true;
+	}
+	return false;
+}
+
+template<typename Char>
+bool read_zigzag_varint(Char*& position, Char* end, std::int32_t& out)
+{
+	std::uint32_t v;
+	if (!read_varint(position, end, v)) return false;
+	out = static_cast<std::int32_t>(v >> 1 ^ (~(v & 1) + 1));
+	return true;
+}
+
+} // namespace proto
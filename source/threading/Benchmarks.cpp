@@ -0,0 +1,257 @@
+#include "Benchmarks.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <rigtorp/MPSCQueue.h>
+
+#include "../canvas/Snapshot.h"
+#include "ThreadPool.h"
+
+// As many as the client's outgoing queue holds.
+static constexpr std::size_t queue_capacity = 1024;
+static constexpr std::size_t messages_per_run = 4'000'000;
+static constexpr int max_producers = 8;
+
+static constexpr int encodes_per_run = 64;
+static constexpr int benchmark_strokes = 300;
+
+using message = std::uint64_t;
+using seconds = std::chrono::duration<double>;
+
+// Runs producers threads that each call push(thread, i) for their share of
+// messages_per_run, while this thread calls consume() until it returns
+// that many, and returns how long that took.
+template<typename Push, typename Consume>
+static seconds run(int producers, Push push, Consume consume)
+{
+	const std::size_t per_producer = messages_per_run / producers;
+	const std::size_t total = per_producer * producers;
+	std::vector<std::thread> threads;
+	const auto start = std::chrono::steady_clock::now();
+	for (int p = 0; p < producers; ++p) {
+		threads.emplace_back([=] {
+			for (std::size_t i = 0; i < per_producer; ++i) {
+				push(static_cast<message>(p) << 32 | i);
+			}
+		});
+	}
+	for (std::size_t received = 0; received < total;) {
+		received += consume();
+	}
+	const seconds elapsed = std::chrono::steady_clock::now() - start;
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	return elapsed;
+}
+
+// The consumer takes everything ready at once, as the sender thread does.
+static seconds run_lock_free(int producers)
+{
+	rigtorp::MPSCQueue<message> queue{ queue_capacity };
+	return run(producers, [&queue](message m) { queue.push(m); }, [&queue] {
+		if (!queue.wait_front(std::chrono::milliseconds{ 10 })) {
+			return std::size_t{ 0 };
+		}
+		const std::size_t count = queue.front_n(queue_capacity).size();
+		queue.pop_n(count);
+		return count;
+	});
+}
+
+// The same with a lock: the consumer swaps out the whole deque at once,
+// and producers block while it holds queue_capacity messages.
+static seconds run_locked(int producers)
+{
+	std::mutex mutex;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+	std::deque<message> queue;
+	std::deque<message> taken;
+	return run(producers, [&](message m) {
+		{
+			std::unique_lock lock{ mutex };
+			not_full.wait(lock, [&] { return queue.size() < queue_capacity; });
+			queue.push_back(m);
+		}
+		not_empty.notify_one();
+	}, [&] {
+		{
+			std::unique_lock lock{ mutex };
+			not_empty.wait(lock, [&] { return !queue.empty(); });
+			std::swap(queue, taken);
+		}
+		not_full.notify_all();
+		const std::size_t count = taken.size();
+		taken.clear();
+		return count;
+	});
+}
+
+// Producers push their messages in batches of 1 to max_batch with push_n,
+// taking up what it leaves behind, while this thread checks that every
+// message arrives once and in the order its producer pushed it. Returns
+// false if one did not.
+static bool check_push_n(int producers)
+{
+	constexpr std::size_t max_batch = 32;
+	rigtorp::MPSCQueue<message> queue{ queue_capacity };
+	const std::size_t per_producer = messages_per_run / producers;
+	std::atomic<std::size_t> full{ 0 };
+	std::vector<std::thread> threads;
+	for (int p = 0; p < producers; ++p) {
+		threads.emplace_back([&queue, &full, p, per_producer] {
+			std::vector<message> batch;
+			std::uint32_t state = static_cast<std::uint32_t>(p) + 1;
+			for (std::size_t sent = 0; sent < per_producer;) {
+				if (batch.empty()) {
+					state = state * 1664525u + 1013904223u;
+					const std::size_t size = std::min<std::size_t>(1 + (state >> 8) % max_batch, per_producer - sent);
+					for (std::size_t i = 0; i < size; ++i) {
+						batch.push_back(static_cast<message>(p) << 32 | (sent + i));
+					}
+				}
+				const std::size_t pushed = queue.push_n(batch.begin(), batch.size());
+				if (pushed == 0) {
+					full.fetch_add(1, std::memory_order_relaxed);
+					std::this_thread::yield();
+				}
+				batch.erase(batch.begin(), batch.begin() + static_cast<std::ptrdiff_t>(pushed));
+				sent += pushed;
+			}
+		});
+	}
+
+	std::vector<std::size_t> expected(producers, 0);
+	bool ok = true;
+	for (std::size_t received = 0; received < per_producer * producers;) {
+		if (!queue.wait_front(std::chrono::milliseconds{ 10 })) {
+			continue;
+		}
+		const auto ready = queue.front_n(queue_capacity);
+		for (const auto& part : { ready.first, ready.second }) {
+			for (std::size_t i = 0; i < part.size; ++i) {
+				const message m = part.data[i];
+				const auto producer = static_cast<std::size_t>(m >> 32);
+				ok = ok && producer < expected.size() && (m & 0xFFFFFFFF) == expected[producer]++;
+			}
+		}
+		queue.pop_n(ready.size());
+		received += ready.size();
+	}
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	std::cout << std::setw(9) << producers << "  " << (ok ? "in order" : "OUT OF ORDER OR LOST") << ", found full " << full.load() << " times\n";
+	return ok;
+}
+
+int bench_queue()
+{
+	std::cout << messages_per_run << " messages into a queue of " << queue_capacity << " on " << std::thread::hardware_concurrency()
+		<< " hardware threads, millions per second:\n";
+	std::cout << "producers  lock-free  mutex+deque  speedup\n";
+	std::cout << std::fixed << std::setprecision(2);
+	for (int producers = 1; producers <= max_producers; producers *= 2) {
+		const double lock_free = messages_per_run / run_lock_free(producers).count() / 1e6;
+		const double locked = messages_per_run / run_locked(producers).count() / 1e6;
+		std::cout << std::setw(9) << producers << std::setw(11) << lock_free << std::setw(13) << locked
+			<< std::setw(8) << lock_free / locked << "x\n";
+	}
+	std::cout << std::defaultfloat;
+
+	std::cout << "push_n from every producer in batches of 1 to 32:\n";
+	bool ok = true;
+	for (int producers = 1; producers <= max_producers; producers *= 2) {
+		ok = check_push_n(producers) && ok;
+	}
+	std::cout << std::flush;
+	return ok ? 0 : 1;
+}
+
+// A canvas covered in long, crossing strokes of many colors, about what a
+// drawer has after a busy round, and as hard to compress.
+static canvas_snapshot busy_canvas()
+{
+	const sdl::size size{ 800, 600 };
+	tiled_canvas pixels{ size, { 255, 255, 255, 255 } };
+	const stroke_rasterizer rasterizer;
+	std::uint32_t state = 1;
+	const auto next = [&state](std::uint32_t range) {
+		state = state * 1664525u + 1013904223u;
+		return static_cast<int>((state >> 8) % range);
+	};
+	for (int stroke = 0; stroke < benchmark_strokes; ++stroke) {
+		const sdl::color color{ static_cast<sdl::u8>(next(256)), static_cast<sdl::u8>(next(256)), static_cast<sdl::u8>(next(256)), 255 };
+		stroke_point from{ static_cast<float>(next(size.width)), static_cast<float>(next(size.height)) };
+		stroke_point previous = from;
+		for (int i = 0; i < 8; ++i) {
+			const stroke_point to{ static_cast<float>(std::clamp(static_cast<int>(from.x) + next(121) - 60, 0, size.width - 1)),
+				static_cast<float>(std::clamp(static_cast<int>(from.y) + next(121) - 60, 0, size.height - 1)) };
+			pixels.draw_segment(rasterizer, from, to, i > 0 ? &previous : nullptr, 3.0f, color);
+			previous = from;
+			from = to;
+		}
+	}
+
+	canvas_snapshot snapshot;
+	snapshot.size = size;
+	for (int row = 0; row < pixels.rows(); ++row) {
+		for (int column = 0; column < pixels.columns(); ++column) {
+			if (const std::uint32_t* tile = pixels.tile_pixels(column, row)) {
+				snapshot.tiles.push_back({ column, row, {} });
+				std::copy_n(tile, snapshot.tiles.back().pixels.size(), snapshot.tiles.back().pixels.begin());
+			}
+		}
+	}
+	return snapshot;
+}
+
+static seconds run_encodes(thread_pool& pool, const canvas_snapshot& snapshot)
+{
+	std::vector<std::future<std::string>> encoded;
+	const auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < encodes_per_run; ++i) {
+		encoded.push_back(pool.async([&snapshot] { return encode_snapshot(snapshot); }));
+	}
+	for (auto& result : encoded) {
+		result.get();
+	}
+	return std::chrono::steady_clock::now() - start;
+}
+
+int bench_pool()
+{
+	const canvas_snapshot snapshot = busy_canvas();
+	const std::size_t cores = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+	std::cout << encodes_per_run << " snapshots of " << snapshot.tiles.size() << " tiles (" << encode_snapshot(snapshot).size() / 1024
+		<< " KiB encoded) on " << cores << " hardware threads:\n";
+	std::cout << "workers  snapshots/s  speedup\n";
+	std::cout << std::fixed << std::setprecision(2);
+	double single = 0;
+	for (std::size_t workers = 1;; workers = std::min(workers * 2, cores)) {
+		thread_pool pool{ workers };
+		const double rate = encodes_per_run / run_encodes(pool, snapshot).count();
+		if (workers == 1) {
+			single = rate;
+		}
+		std::cout << std::setw(7) << workers << std::setw(13) << rate << std::setw(8) << rate / single << "x\n";
+		if (workers == cores) {
+			break;
+		}
+	}
+	std::cout << std::defaultfloat << std::flush;
+	return 0;
+}
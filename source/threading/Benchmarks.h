@@ -0,0 +1,16 @@
+#pragma once
+
+// Command line benchmarks that print their results and return the exit
+// code, so they run on any machine the client builds on.
+
+// Pushes small messages from 1 to 8 producer threads to one consumer,
+// through rigtorp::MPSCQueue and through a mutex-guarded std::deque, and
+// prints the throughput of both. Then checks that batches pushed with
+// push_n from every producer arrive once each and in order, and returns 1
+// if they do not.
+int bench_queue();
+
+// Encodes the snapshot of a busy canvas many times over on pools of 1, 2,
+// 4 and so on up to one worker per core, and prints how the throughput
+// scales.
+int bench_pool();
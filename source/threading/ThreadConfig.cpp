@@ -0,0 +1,184 @@
+#include "ThreadConfig.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+
+#include <sdlw/cpu_info.hpp>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+static const char* display_name(const thread_config& config)
+{
+	return config.name.empty() ? "thread" : config.name.c_str();
+}
+
+static void set_name(const thread_config& config)
+{
+	if (config.name.empty()) {
+		return;
+	}
+#if defined(_WIN32)
+	std::wstring name{ config.name.begin(), config.name.end() };
+	::SetThreadDescription(::GetCurrentThread(), name.c_str());
+#elif defined(__linux__)
+	// Linux allows 15 characters.
+	::pthread_setname_np(::pthread_self(), config.name.substr(0, 15).c_str());
+#endif
+}
+
+static void set_affinity(const thread_config& config)
+{
+	if (config.cpus.empty()) {
+		return;
+	}
+#if defined(_WIN32)
+	DWORD_PTR mask = 0;
+	for (int cpu : config.cpus) {
+		if (cpu >= 0 && cpu < static_cast<int>(sizeof(mask) * 8)) {
+			mask |= DWORD_PTR{ 1 } << cpu;
+		}
+	}
+	if (mask == 0 || ::SetThreadAffinityMask(::GetCurrentThread(), mask) == 0) {
+		std::cerr << "Could not pin " << display_name(config) << " thread, error " << ::GetLastError() << "." << std::endl;
+	}
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu : config.cpus) {
+		if (cpu >= 0 && cpu < CPU_SETSIZE) {
+			CPU_SET(cpu, &set);
+		}
+	}
+	if (int error = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set); error != 0) {
+		std::cerr << "Could not pin " << display_name(config) << " thread. " << std::strerror(error) << std::endl;
+	}
+#else
+	std::cerr << "Pinning threads is not supported here; " << display_name(config) << " thread runs anywhere." << std::endl;
+#endif
+}
+
+#if defined(__linux__)
+// Whether the process has CAP_SYS_NICE, which lifts the limits below.
+static bool has_sys_nice()
+{
+	constexpr int cap_sys_nice = 23;
+	std::ifstream status{ "/proc/self/status" };
+	for (std::string line; std::getline(status, line);) {
+		if (line.rfind("CapEff:", 0) == 0) {
+			return (std::stoull(line.substr(7), nullptr, 16) >> cap_sys_nice & 1) != 0;
+		}
+	}
+	return false;
+}
+#endif
+
+// Linux only lets unprivileged processes lower priorities unless
+// RLIMIT_NICE allows more, so there a failure to raise one is expected
+// and not worth a warning on every start.
+static bool may_raise_priority()
+{
+#if defined(__linux__)
+	rlimit limit;
+	return has_sys_nice() || (::getrlimit(RLIMIT_NICE, &limit) == 0 && limit.rlim_cur > 20);
+#else
+	return true;
+#endif
+}
+
+static bool may_use_realtime()
+{
+#if defined(__linux__)
+	rlimit limit;
+	return has_sys_nice() || (::getrlimit(RLIMIT_RTPRIO, &limit) == 0 && limit.rlim_cur > 0);
+#else
+	return true;
+#endif
+}
+
+static bool set_realtime(const thread_config& config)
+{
+#if defined(__linux__)
+	sched_param param{};
+	param.sched_priority = ::sched_get_priority_min(SCHED_FIFO);
+	if (int error = ::pthread_setschedparam(::pthread_self(), SCHED_FIFO, &param); error != 0) {
+		std::cerr << "No real-time scheduling for " << display_name(config) << " thread. " << std::strerror(error) << std::endl;
+		return false;
+	}
+	return true;
+#else
+	if (!sdl::this_thread::set_priority(sdl::thread_priority::time_critical)) {
+		std::cerr << "No real-time scheduling for " << display_name(config) << " thread. " << sdl::get_error() << std::endl;
+		return false;
+	}
+	return true;
+#endif
+}
+
+thread_layout default_thread_layout()
+{
+	thread_layout layout;
+	layout.render.name = "render";
+	layout.receiver.name = "receiver";
+	layout.sender.name = "sender";
+	// The network threads stay at normal priority so that they yield to
+	// the render loop.
+	layout.render.priority = sdl::thread_priority::high;
+
+	int cpus = sdl::cpu_count();
+	if (cpus >= 4) {
+		layout.render.cpus = { 0 };
+		for (int cpu = 1; cpu < cpus; ++cpu) {
+			layout.receiver.cpus.push_back(cpu);
+		}
+		layout.sender.cpus = layout.receiver.cpus;
+	}
+	return layout;
+}
+
+thread_layout plain_thread_layout()
+{
+	thread_layout layout;
+	layout.render.name = "render";
+	layout.receiver.name = "receiver";
+	layout.sender.name = "sender";
+	return layout;
+}
+
+void configure_this_thread(const thread_config& config)
+{
+	set_name(config);
+	set_affinity(config);
+	if (config.realtime && may_use_realtime() && set_realtime(config)) {
+		return;
+	}
+	if (config.priority > sdl::thread_priority::normal && !may_raise_priority()) {
+		return;
+	}
+	if (!sdl::this_thread::set_priority(config.priority)) {
+		std::cerr << "Could not set " << display_name(config) << " thread priority. " << sdl::get_error() << std::endl;
+	}
+}
+
+std::jthread start_thread(const thread_config& config, std::function<void(std::stop_token)> f)
+{
+	return std::jthread{ [config, f = std::move(f)](std::stop_token stop) {
+		configure_this_thread(config);
+		f(std::move(stop));
+	} };
+}
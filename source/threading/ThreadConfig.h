@@ -0,0 +1,46 @@
+#pragma once
+
+#include <functional>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sdlw/thread.hpp>
+
+// Where a thread runs and how urgently. Everything is best effort: whatever
+// the platform or our permissions do not allow is logged and skipped.
+struct thread_config {
+	std::string name;
+	sdl::thread_priority priority = sdl::thread_priority::normal;
+
+	// Logical CPUs the thread may run on; empty means any.
+	std::vector<int> cpus;
+
+	// Real-time scheduling: SCHED_FIFO on Linux, which needs CAP_SYS_NICE or
+	// an RLIMIT_RTPRIO and is not tried without, and time-critical priority
+	// elsewhere. Only for threads that spend nearly all their time blocked.
+	bool realtime = false;
+};
+
+// The render thread runs on the first CPU at high priority, and the
+// network threads share the rest at normal priority, so neither preempts
+// the other. With fewer than four CPUs nothing is pinned, as that would
+// leave either side starved. Where raising a priority needs privileges the
+// process lacks, as on Linux, the render thread stays at normal priority.
+struct thread_layout {
+	thread_config render;
+	thread_config receiver;
+	thread_config sender;
+};
+
+thread_layout default_thread_layout();
+
+// Only names the threads, to compare default_thread_layout against.
+thread_layout plain_thread_layout();
+
+// Names the calling thread and applies the rest of config to it.
+void configure_this_thread(const thread_config& config);
+
+// Starts a thread configured by config that runs f with its stop token.
+std::jthread start_thread(const thread_config& config, std::function<void(std::stop_token)> f);
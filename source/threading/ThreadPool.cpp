@@ -0,0 +1,155 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+
+#include <sdlw/cpu_info.hpp>
+
+// The pool and worker running on this thread, if any.
+static thread_local const thread_pool* current_pool = nullptr;
+static thread_local std::size_t current_worker = 0;
+
+std::size_t thread_pool::default_size()
+{
+	int cpus = sdl::cpu_count();
+	return static_cast<std::size_t>(std::max(cpus - 1, 1));
+}
+
+thread_pool::thread_pool(std::size_t threads)
+{
+	threads = std::max<std::size_t>(threads, 1);
+	for (std::size_t i = 0; i < threads; ++i) {
+		_workers.push_back(std::make_unique<worker>());
+	}
+	for (std::size_t i = 0; i < threads; ++i) {
+		_threads.emplace_back([this, i] { run(i); });
+	}
+}
+
+thread_pool::~thread_pool()
+{
+	{
+		std::lock_guard lock{ _sleep_mutex };
+		_stopping = true;
+	}
+	_wake.notify_all();
+	for (std::thread& thread : _threads) {
+		thread.join();
+	}
+}
+
+void thread_pool::submit(job work, priority level)
+{
+	std::size_t index = current_pool == this
+		? current_worker
+		: _next.fetch_add(1, std::memory_order_relaxed) % _workers.size();
+	{
+		worker& w = *_workers[index];
+		std::lock_guard lock{ w.mutex };
+		w.jobs[static_cast<std::size_t>(level)].push_back(std::move(work));
+	}
+	_queued.fetch_add(1, std::memory_order_release);
+	{
+		// Pairs with the check under the lock in run(), so a worker about
+		// to sleep cannot miss this job.
+		std::lock_guard lock{ _sleep_mutex };
+	}
+	_wake.notify_one();
+}
+
+bool thread_pool::take(std::size_t index, job& work)
+{
+	for (std::size_t level = 0; level < static_cast<std::size_t>(priority::count); ++level) {
+		{
+			worker& own = *_workers[index];
+			std::lock_guard lock{ own.mutex };
+			auto& jobs = own.jobs[level];
+			if (!jobs.empty()) {
+				work = std::move(jobs.back());
+				jobs.pop_back();
+				return true;
+			}
+		}
+		for (std::size_t i = 1; i < _workers.size(); ++i) {
+			worker& victim = *_workers[(index + i) % _workers.size()];
+			std::lock_guard lock{ victim.mutex };
+			auto& jobs = victim.jobs[level];
+			if (!jobs.empty()) {
+				work = std::move(jobs.front());
+				jobs.pop_front();
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void thread_pool::run(std::size_t index)
+{
+	current_pool = this;
+	current_worker = index;
+	for (;;) {
+		job work;
+		if (_queued.load(std::memory_order_acquire) != 0 && take(index, work)) {
+			_queued.fetch_sub(1, std::memory_order_relaxed);
+			try {
+				work();
+			}
+			catch (const std::exception& e) {
+				std::cerr << "Job stopped. " << e.what() << std::endl;
+			}
+			continue;
+		}
+		std::unique_lock lock{ _sleep_mutex };
+		if (_queued.load(std::memory_order_acquire) != 0) {
+			continue;
+		}
+		if (_stopping) {
+			return;
+		}
+		_wake.wait(lock);
+	}
+}
+
+void thread_pool::post_main(job work)
+{
+	std::function<bool()> wake;
+	{
+		std::lock_guard lock{ _main_mutex };
+		_main_jobs.push_back(std::move(work));
+		if (!_main_woken) {
+			wake = _main_wake;
+			_main_woken = true;
+		}
+	}
+	if (wake && !wake()) {
+		std::lock_guard lock{ _main_mutex };
+		_main_woken = false;
+	}
+}
+
+void thread_pool::set_main_wake(std::function<bool()> wake)
+{
+	std::lock_guard lock{ _main_mutex };
+	_main_wake = std::move(wake);
+}
+
+void thread_pool::run_main()
+{
+	{
+		std::lock_guard lock{ _main_mutex };
+		std::swap(_main_jobs, _main_running);
+		_main_woken = false;
+	}
+	for (job& work : _main_running) {
+		work();
+	}
+	_main_running.clear();
+}
+
+thread_pool& shared_pool()
+{
+	static thread_pool pool;
+	return pool;
+}
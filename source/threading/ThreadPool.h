@@ -0,0 +1,131 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// A type-erased, move-only piece of work.
+class job {
+public:
+	job() = default;
+
+	template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, job>>>
+	job(F&& f)
+		: _callable(std::make_unique<callable<std::decay_t<F>>>(std::forward<F>(f)))
+	{}
+
+	void operator()() { _callable->call(); }
+	explicit operator bool() const { return _callable != nullptr; }
+
+private:
+	struct callable_base {
+		virtual ~callable_base() = default;
+		virtual void call() = 0;
+	};
+
+	template<typename F>
+	struct callable : callable_base {
+		F f;
+		explicit callable(F&& f) : f(std::move(f)) {}
+		explicit callable(const F& f) : f(f) {}
+		void call() override { f(); }
+	};
+
+	std::unique_ptr<callable_base> _callable;
+};
+
+enum class priority { high, normal, low, count };
+
+// Work-stealing pool for CPU-heavy work like rasterizing, image encoding
+// and compression.
+//
+// Every worker has its own deques, one per priority. Jobs submitted from a
+// worker go to the back of its own deque and it takes them back from there,
+// newest first, while idle workers steal the oldest jobs from the front of
+// the others'. Higher priorities are always searched first, across all
+// workers, before a lower one.
+//
+// Jobs that must run on the main thread, like anything touching SDL video,
+// go through post_main instead. The main loop calls run_main when woken.
+class thread_pool {
+public:
+	// Leaves one core for the main thread.
+	static std::size_t default_size();
+
+	explicit thread_pool(std::size_t threads = default_size());
+
+	// Finishes the jobs already submitted, then joins the workers.
+	~thread_pool();
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	// Runs work on a worker. If it throws, the exception is logged and the
+	// worker goes on with the next job.
+	void submit(job work, priority level = priority::normal);
+
+	// Like submit, but hands back the result, or the exception f threw.
+	template<typename F>
+	auto async(F f, priority level = priority::normal) -> std::future<std::invoke_result_t<F&>>
+	{
+		std::packaged_task<std::invoke_result_t<F&>()> task{ std::move(f) };
+		auto future = task.get_future();
+		submit(std::move(task), level);
+		return future;
+	}
+
+	// Queues work for the main thread and calls the wake function set with
+	// set_main_wake, if any. Safe to call from any thread.
+	void post_main(job work);
+
+	// Sets what post_main calls to get the main thread to call run_main.
+	// Set it before posting; it must not block or throw. It returns false
+	// if it could not wake the main thread, and is then called again on
+	// the next post.
+	void set_main_wake(std::function<bool()> wake);
+
+	// Runs the jobs posted for the main thread so far. Call it on the main
+	// thread only.
+	void run_main();
+
+	std::size_t size() const { return _workers.size(); }
+
+private:
+	struct worker {
+		std::mutex mutex;
+		std::array<std::deque<job>, static_cast<std::size_t>(priority::count)> jobs;
+	};
+
+	void run(std::size_t index);
+	bool take(std::size_t index, job& work);
+
+	std::vector<std::unique_ptr<worker>> _workers;
+	std::vector<std::thread> _threads;
+	std::atomic<std::size_t> _next{ 0 };
+
+	// Jobs submitted but not yet taken; lets idle workers sleep.
+	std::atomic<std::size_t> _queued{ 0 };
+	std::mutex _sleep_mutex;
+	std::condition_variable _wake;
+	bool _stopping = false;
+
+	std::mutex _main_mutex;
+	std::vector<job> _main_jobs;
+	std::vector<job> _main_running;
+	std::function<bool()> _main_wake;
+	// Whether the main thread was woken for the jobs in _main_jobs.
+	bool _main_woken = false;
+};
+
+// The pool shared by the whole client, created on first use.
+thread_pool& shared_pool();